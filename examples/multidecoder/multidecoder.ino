@@ -0,0 +1,156 @@
+/**
+ * \file MultiDecoder.ino
+ *
+ * \brief Example sketch of playing tracks on several VS10xx chips sharing the
+ * SPI bus, with "Arduino_Library-vs1053_for_SdFat" and its vs1053_decoder
+ * \remarks Comments are implemented with Doxygen Markdown format
+ *
+ * \author onelife
+ *
+ * The MP3 shield plays "track001.mp3" as usual, while each of the additional
+ * VS10xx plays "track002.mp3", "track003.mp3" and so on, starting them over
+ * once ended. Every second, the bytes fed to the additional decoders are
+ * summed and printed as the aggregate bit-rate the bus sustains, which is
+ * the figure to watch when adding chips or raising the tracks' bit-rates.
+ *
+ * The pins of the additional chips below are an example, to be changed to
+ * the actual wiring. Their SCLK, MOSI and MISO are those of the shield.
+ */
+
+#include <SPI.h>
+
+//Add the SdFat Libraries
+#include <SdFat.h>
+
+//and the MP3 Shield Library
+#include <vs1053_SdFat.h>
+#include <vs1053_SdFat_decoder.h>
+
+// Below is not needed if interrupt driven. Safe to remove if not using.
+#if defined(USE_MP3_REFILL_MEANS) && USE_MP3_REFILL_MEANS == USE_MP3_Timer1
+  #include <TimerOne.h>
+#elif defined(USE_MP3_REFILL_MEANS) && USE_MP3_REFILL_MEANS == USE_MP3_SimpleTimer
+  #include <SimpleTimer.h>
+#endif
+
+/**
+ * \brief Object instancing the SdFat library.
+ *
+ * principal object for handling all SdCard functions.
+ */
+SdFat sd;
+
+/**
+ * \brief Object instancing the vs1053 library.
+ *
+ * principal object for handling the VS1053 of the shield.
+ */
+vs1053 MP3player;
+
+/**
+ * \brief The additional VS10xx chips, by XCS, XDCS, DREQ and reset pins.
+ */
+vs1053_decoder decoders[] = {
+  vs1053_decoder(A0, A1, A2, A3),
+  vs1053_decoder(4, 5, A4, DECODER_NO_RESET),
+};
+
+/** \brief number of additional VS10xx chips.*/
+#define DECODERS (sizeof(decoders) / sizeof(decoders[0]))
+
+bool isBegun[DECODERS + 1]; // chips begun without error, the shield's last.
+uint32_t lastFed; // bytes fed to the decoders at the last report.
+uint32_t lastReportAt; // milliseconds of the last report.
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Play a track on a decoder
+ *
+ * \param[in] n index of the decoder, playing "track00<n + 2>.mp3".
+ */
+void playOn(uint8_t n) {
+  char fileName[13];
+  uint8_t result;
+
+  sprintf(fileName, "track%03d.mp3", n + 2);
+  result = decoders[n].play(fileName);
+  if (result != 0) {
+    Serial.print(F("Error code: "));
+    Serial.print(result);
+    Serial.print(F(" when trying to play "));
+    Serial.println(fileName);
+  }
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Setup the Arduino Chip's feature for our use.
+ *
+ * Initializes the SdCard, the shield's VS1053 and the additional chips, the
+ * tracks being started by loop().
+ *
+ * \see
+ * \ref Error_Codes
+ */
+void setup() {
+  uint8_t result; //result code from some function as to be tested at later time.
+
+  Serial.begin(115200);
+
+  //Initialize the SdCard.
+  if(!sd.begin(SD_SEL, SPI_FULL_SPEED)) sd.initErrorHalt();
+  if(!sd.chdir("/")) sd.errorHalt("sd.chdir");
+
+  //Initialize the MP3 Player Shield
+  result = MP3player.begin();
+  isBegun[DECODERS] = (result == 0);
+  if(result != 0) {
+    Serial.print(F("Error code: "));
+    Serial.print(result);
+    Serial.println(F(" when trying to start MP3 player"));
+  }
+
+  //Initialize the additional chips, same error codes as begin() above
+  for (uint8_t n = 0; n < DECODERS; n++) {
+    result = decoders[n].begin();
+    isBegun[n] = (result == 0);
+    if(result != 0) {
+      Serial.print(F("Error code: "));
+      Serial.print(result);
+      Serial.print(F(" when trying to start decoder "));
+      Serial.println(n);
+    }
+  }
+
+  lastFed = 0;
+  lastReportAt = millis();
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Main Loop the Arduino Chip
+ *
+ * vs1053::available() feeds the additional decoders, so it is called on each
+ * loop whatever the means of refilling. Tracks are started on the chips begun
+ * when not playing, and the aggregate bit-rate is reported every second.
+ */
+void loop() {
+  uint32_t fed = 0;
+
+  MP3player.available();
+
+  if (isBegun[DECODERS] && !MP3player.isBusy()) MP3player.playTrack(1);
+  for (uint8_t n = 0; n < DECODERS; n++) {
+    if (isBegun[n] && !decoders[n].isBusy()) playOn(n);
+    fed += decoders[n].fedBytes();
+  }
+
+  if (millis() - lastReportAt >= 1000) {
+    uint32_t elapsed = millis() - lastReportAt;
+    Serial.print(F("Aggregate bit-rate of the decoders: "));
+    Serial.print((fed - lastFed) * 8 / elapsed);
+    Serial.println(F(" kbit/s"));
+    lastFed = fed;
+    lastReportAt += elapsed;
+  }
+}
@@ -7,6 +7,9 @@
 */
 
 #include <vs1053_SdFat.h>
+#include <vs1053_SdFat_catalog.h>
+#include <vs1053_SdFat_playlist.h>
+#include <vs1053_SdFat_decoder.h>
 // inslude the SPI library:
 #include "SPI.h"
 //avr pgmspace library for storing the LUT in program flash instead of sram
@@ -14,10 +17,14 @@
 
 #define DEBUG 0
 
+/* The 32-byte chunks of the VSdsp's 2048 bytes FIFO, played after being fed */
+#define SEEK_FIFO_CHUNKS (2048 / 32)
+
 #if DEBUG
   static uint32_t cntIsr;
   static uint32_t cntRead;
   static uint32_t cntWork;
+  static uint32_t seekStarted;
 #endif
 
 /**
@@ -48,6 +55,312 @@ static const uint16_t bitrate_table[15][6] PROGMEM = {
                  {448,384,320,256,160,160}  //1110
                };
 
+/**
+ * \brief Length of a MPEG audio frame
+ *
+ * \param[in] head the 4 bytes of the frame header.
+ *
+ * \return the length of the frame in bytes, including the header, or zero
+ * when head is not a valid frame header.
+ */
+static uint16_t mp3FrameLength(const uint8_t* head) {
+  uint8_t version = (head[1] >> 3) & 0x03; // 3: MPEG 1, 2: MPEG 2, 0: MPEG 2.5
+  uint8_t layer = (head[1] >> 1) & 0x03;   // 3: Layer I, 2: Layer II, 1: Layer III
+  uint8_t index = head[2] >> 4;
+  uint8_t rate = (head[2] >> 2) & 0x03;
+  uint8_t padding = (head[2] >> 1) & 0x01;
+  uint32_t sampleRate;
+  uint32_t bitrate;
+
+  if ((head[0] != 0xFF) || ((head[1] & 0xE0) != 0xE0) || (version == 1) || !layer || \
+      !index || (index == 15) || (rate == 3)) return 0;
+  sampleRate = (rate == 0) ? 44100 : (rate == 1) ? 48000 : 32000;
+  sampleRate >>= (version == 3) ? 0 : (version == 2) ? 1 : 2;
+  bitrate = pgm_read_word_near ( &(bitrate_table[index][(version == 3) ? 3 - layer : (layer == 3) ? 3 : 4]) ) * 1000UL;
+  if (layer == 3) return (12 * bitrate / sampleRate + padding) * 4;
+  return (((layer == 1) && (version != 3)) ? 72 : 144) * bitrate / sampleRate + padding;
+}
+
+/**
+ * \brief ASF object GUIDs
+ *
+ * The GUIDs of the ASF objects needed to locate duration, packets and index
+ * of WMA files, in their on-disk (little endian) byte order.
+ *
+ * <A HREF = "https://docs.microsoft.com/en-us/windows/win32/wmformat/asf-specification" > ASF Specification </A>
+ * \note PROGMEM macro forces to Flash space.
+ */
+static const uint8_t asf_header_guid[16] PROGMEM = {
+  0x30, 0x26, 0xB2, 0x75, 0x8E, 0x66, 0xCF, 0x11, 0xA6, 0xD9, 0x00, 0xAA, 0x00, 0x62, 0xCE, 0x6C};
+static const uint8_t asf_file_properties_guid[16] PROGMEM = {
+  0xA1, 0xDC, 0xAB, 0x8C, 0x47, 0xA9, 0xCF, 0x11, 0x8E, 0xE4, 0x00, 0xC0, 0x0C, 0x20, 0x53, 0x65};
+static const uint8_t asf_data_guid[16] PROGMEM = {
+  0x36, 0x26, 0xB2, 0x75, 0x8E, 0x66, 0xCF, 0x11, 0xA6, 0xD9, 0x00, 0xAA, 0x00, 0x62, 0xCE, 0x6C};
+static const uint8_t asf_simple_index_guid[16] PROGMEM = {
+  0x90, 0x08, 0x00, 0x33, 0xB1, 0xE5, 0xCF, 0x11, 0x89, 0xF4, 0x00, 0xA0, 0xC9, 0x03, 0x49, 0xCB};
+
+/**
+ * \brief Assemble a little endian 32-bit word
+ *
+ * \param[in] p pointer to the least significant byte.
+ */
+static uint32_t le32(const uint8_t* p) {
+  return ((uint32_t)p[3]) << 24 | \
+         ((uint32_t)p[2]) << 16 | \
+         ((uint32_t)p[1]) << 8 | \
+         ((uint32_t)p[0]);
+}
+
+/**
+ * \brief Store a little endian word
+ *
+ * \param[out] p pointer to the least significant byte.
+ * \param[in] value word to be stored.
+ * \param[in] size number of bytes, 2 or 4.
+ */
+static void setLe(uint8_t* p, uint32_t value, uint8_t size) {
+  while (size--) {
+    *p++ = (uint8_t)value;
+    value >>= 8;
+  }
+}
+
+/**
+ * \brief Latin-1 Supplement letters folded to ASCII
+ *
+ * Indexed by the code point minus 0xC0, as used to show tag text on displays
+ * limited to ASCII.
+ *
+ * \note PROGMEM macro forces to Flash space.
+ */
+static const char latin1_fold[] PROGMEM =
+  "AAAAAAACEEEEIIIIDNOOOOOxOUUUUYPs"
+  "aaaaaaaceeeeiiiidnooooo/ouuuuypy";
+
+/**
+ * \brief Fold a code point to a printable ASCII character
+ *
+ * \param[in] cp unicode code point.
+ *
+ * \return the character itself when ASCII, its base letter when in Latin-1,
+ * otherwise '?'.
+ */
+static char foldToAscii(uint16_t cp) {
+  if (cp < 0x20) return ' ';
+  if (cp < 0x7F) return (char)cp;
+  if ((cp >= 0xC0) && (cp <= 0xFF)) return (char)pgm_read_byte(&latin1_fold[cp - 0xC0]);
+  return '?';
+}
+
+/**
+ * \brief Parse a ReplayGain value
+ *
+ * \param[in] text gain as written by taggers, such as "-6.48 dB".
+ *
+ * \return the gain in hundredths of a dB.
+ */
+static int16_t parseGain(const char* text) {
+  bool isNegative = false;
+  int32_t gain = 0;
+  int8_t decimals = -1;
+
+  while (*text == ' ') text++;
+  if ((*text == '-') || (*text == '+')) isNegative = *text++ == '-';
+  for ( ; *text; text++) {
+    if ((*text == '.') && (decimals < 0)) {
+      decimals = 0;
+    } else if (isdigit(*text)) {
+      if ((decimals < 2) && (gain < 100000L)) {
+        gain = gain * 10 + (*text - '0');
+        if (decimals >= 0) decimals++;
+      }
+    } else {
+      break;
+    }
+  }
+  for (decimals = (decimals < 0) ? 0 : decimals; decimals < 2; decimals++) gain *= 10;
+  if (gain > 32767) gain = 32767;
+  return isNegative ? -gain : gain;
+}
+
+/**
+ * \brief Forward reader of tag information
+ *
+ * Streams an ID3v2 tag, or the header packets of an Ogg stream, through a
+ * scratch buffer of BUFFER_SIZE bytes.
+ *
+ * For ID3v2 the unsynchronisation scheme is removed when requested. A read is
+ * bounded both by a file position and by a count of bytes returned, as ID3v2.3
+ * measures frames after removing the unsynchronisation while ID3v2.4 measures
+ * them on the file.
+ *
+ * For Ogg the page headers are stepped over, so that packets spanning pages
+ * read as one continuous stream.
+ */
+struct tag_reader_m {
+  SdFile* file;
+  uint8_t* buf;
+  uint8_t len;
+  uint8_t offset;
+  bool isUnsync;
+  bool isFF;
+  bool isOgg;
+/** \brief file position of the next byte.*/
+  uint32_t pos;
+/** \brief file position ending the current read.*/
+  uint32_t limit;
+/** \brief bytes left to be returned by the current read.*/
+  uint32_t count;
+/** \brief file position ending the data of the current Ogg page.*/
+  uint32_t pageEnd;
+
+  int16_t fetch() {
+    if (pos >= limit) return -1;
+    if (offset == len) {
+      uint32_t n = limit - pos;
+      int16_t got = file->read(buf, (n < BUFFER_SIZE) ? n : BUFFER_SIZE);
+      if (got <= 0) {
+        limit = pos;
+        return -1;
+      }
+      len = got;
+      offset = 0;
+    }
+    pos++;
+    return buf[offset++];
+  }
+
+  bool nextPage() {
+    uint8_t head[27];
+    uint32_t size = 0;
+    for (uint8_t i = 0; i < sizeof(head); i++) {
+      int16_t c = fetch();
+      if (c < 0) return false;
+      head[i] = c;
+    }
+    if (memcmp(head, "OggS", 4)) return false;
+    for (uint8_t i = 0; i < head[26]; i++) {
+      int16_t c = fetch(); // lacing values
+      if (c < 0) return false;
+      size += c;
+    }
+    pageEnd = pos + size;
+    return true;
+  }
+
+  int16_t raw() {
+    while (isOgg && (pos == pageEnd)) {
+      if (!nextPage()) {
+        limit = pos;
+        return -1;
+      }
+    }
+    return fetch();
+  }
+
+  int16_t next() {
+    if (!count) return -1;
+    int16_t c = raw();
+    if (isUnsync && isFF && (c == 0x00)) c = raw(); // drop the inserted 0x00
+    if (c < 0) return -1;
+    isFF = (c == 0xFF);
+    count--;
+    return c;
+  }
+
+  uint32_t nextLe32() {
+    uint8_t word[4] = {0, 0, 0, 0};
+    count = 4;
+    for (uint8_t i = 0; i < 4; i++) word[i] = next();
+    return le32(word);
+  }
+
+  void advance(uint32_t n) {
+    if (n <= (uint32_t)(len - offset)) {
+      offset += n;
+    } else {
+      file->seekSet(pos + n);
+      offset = len; // buffer is stale
+    }
+    pos += n;
+  }
+
+  void skip() {
+    if (isUnsync) {
+      while (next() >= 0);
+      return;
+    }
+    while (count && (pos < limit)) {
+      if (isOgg && (pos == pageEnd)) {
+        if (!nextPage()) break;
+        continue;
+      }
+      uint32_t step = (isOgg ? pageEnd : limit) - pos;
+      if ((count != 0xFFFFFFFFUL) && (count < step)) step = count;
+      advance(step);
+      if (count != 0xFFFFFFFFUL) count -= step;
+      if (!isOgg) break;
+    }
+    count = 0;
+    isFF = false;
+  }
+};
+
+/**
+ * \brief Read a string of an ID3v2 frame, or of a Vorbis comment
+ *
+ * \param[in] r reader positioned on the string.
+ * \param[in] encoding text encoding byte of the frame, 3 for UTF-8.
+ * \param[out] dest buffer to be updated with the terminated ASCII text.
+ * \param[in] size size of dest.
+ *
+ * Reads up to the string's terminator or the end of the read, folding
+ * Latin-1, UTF-16 (with or without BOM) and UTF-8 text to ASCII. Characters
+ * beyond the size of dest are dropped.
+ */
+static void readTagString(tag_reader_m* r, uint8_t encoding, char* dest, uint8_t size) {
+  bool isLE = false;
+  uint8_t n = 0;
+
+  for (;;) {
+    int16_t c = r->next();
+    if (c < 0) break;
+    uint16_t cp = c;
+    if ((encoding == 1) || (encoding == 2)) {
+      int16_t c2 = r->next();
+      if (c2 < 0) break;
+      cp = isLE ? ((uint16_t)c2 << 8 | c) : ((uint16_t)c << 8 | c2);
+      if (cp == 0xFEFF) continue; // BOM, in the byte order assumed
+      if (cp == 0xFFFE) {         // BOM, in the other byte order
+        isLE = !isLE;
+        continue;
+      }
+    } else if ((encoding == 3) && (c >= 0x80)) {
+      uint8_t lead = c;
+      uint8_t more = (lead >= 0xF0) ? 3 : (lead >= 0xE0) ? 2 : 1;
+      cp = lead & (0x3F >> more);
+      while (more-- && ((c = r->next()) >= 0)) cp = (cp << 6) | (c & 0x3F);
+      if ((lead < 0xC0) || (lead >= 0xF0)) cp = '?'; // stray or beyond 16-bit
+    }
+    if (cp == 0) break;
+    if (n < size - 1) dest[n++] = foldToAscii(cp);
+  }
+  while (n && (dest[n - 1] == ' ')) n--;
+  dest[n] = '\0';
+}
+
+/**
+ * \brief Match the identifier of an ID3v2 frame
+ *
+ * \param[in] head frame header.
+ * \param[in] version major version of the tag.
+ * \param[in] id frame identifier of ID3v2.3 and v2.4.
+ * \param[in] id22 three character frame identifier of ID3v2.2.
+ */
+static bool isId3Frame(const uint8_t* head, uint8_t version, const char* id, const char* id22) {
+  return (version == 2) ? !memcmp(head, id22, 3) : !memcmp(head, id, 4);
+}
+
 /*
  * Format of a MIDI file into a char arrar. Simply one note on and then off.
 */
@@ -112,12 +425,79 @@ bool vs1053::isSkipping;
 uint16_t vs1053::spi_Read_Rate = SPI_CLOCK_DIV16;
 uint16_t vs1053::spi_Write_Rate = SPI_CLOCK_DIV16;
 
-format_m vs1053::trackFormat;
-uint16_t vs1053::duration;
+track_meta_m vs1053::meta;
 uint32_t vs1053::position;
+uint32_t vs1053::positionMsec;
+uint32_t vs1053::positionMsecAt;
+uint32_t vs1053::positionReadAt;
 uint16_t vs1053::skipToPosition;
+uint32_t vs1053::seekOffset;
+uint8_t vs1053::seekStep;
+uint16_t vs1053::seekResync;
+bool vs1053::isResyncSet;
+seek_point_m vs1053::seekTable[SEEK_TABLE_SIZE];
+track_tag_m vs1053::tag;
+#if USE_TRACK_QUEUE
+SdFile vs1053::nextTrack;
+track_meta_m vs1053::nextMeta;
+track_tag_m vs1053::nextTag;
+uint16_t vs1053::playCount;
+#endif
 bool vs1053::isRecordingStereo;
+format_m vs1053::recordFormat;
+uint16_t vs1053::recordSampleRate;
+uint16_t vs1053::recordHeaderSize;
+char vs1053::recordName[RECORD_PATH_LENGTH];
+uint16_t vs1053::recordFileNo;
+uint32_t vs1053::recordMaxSize;
+uint32_t vs1053::rotateMsec;
+uint32_t vs1053::rotateBytes;
+bool vs1053::isRotating;
+uint32_t vs1053::recordFileAt;
+uint8_t vs1053::oggPageAt;
+uint8_t vs1053::oggSegments;
+uint16_t vs1053::oggPageLeft;
+uint32_t vs1053::oggPageOffset;
+bool vs1053::isOggAudio;
+uint8_t* vs1053::ringBuffer;
+uint16_t vs1053::ringSize;
+uint32_t vs1053::ringTotal;
+bool vs1053::isArmed;
+volatile bool vs1053::isTriggered;
+bool vs1053::isRefillEnabled;
+uint32_t vs1053::ringCommitted;
+uint32_t vs1053::recordProduced;
+uint32_t vs1053::recordEmitted;
+uint16_t vs1053::voxStartLevel;
+uint16_t vs1053::voxStopLevel;
+uint16_t vs1053::voxAttack;
+uint16_t vs1053::voxHang;
+bool vs1053::isVoxActive;
+bool vs1053::isVoxPending;
+uint32_t vs1053::voxSince;
+bool vs1053::isVoxClosing;
+uint16_t vs1053::recordingPeak;
+bool vs1053::isRecordingFile;
+Stream* vs1053::recordStream;
+uint8_t* vs1053::streamQueue;
+uint16_t vs1053::streamQueueSize;
+uint16_t vs1053::streamHead;
+uint16_t vs1053::streamQueued;
+bool vs1053::isStreamDropping;
+bool vs1053::isRecordingPcm;
 uint16_t vs1053::recordingLevel;
+bool vs1053::isContiguous;
+uint32_t vs1053::recordBlock;
+uint32_t vs1053::recordEndBlock;
+uint32_t vs1053::recordLength;
+uint16_t vs1053::sectorFill;
+uint8_t* vs1053::sectorBuffer;
+uint32_t vs1053::drainedAt;
+uint16_t vs1053::drainLeft;
+uint32_t vs1053::drainRate;
+record_stats_m vs1053::recordStats;
+uint32_t vs1053::recordStartedAt;
+uint32_t vs1053::writeLatency[RECORD_LATENCY_BUCKETS];
 
 uint8_t vs1053::VolL = 0x30;
 uint8_t vs1053::VolR = 0x30;
@@ -133,6 +513,10 @@ uint8_t vs1053::mp3DataBuffer[BUFFER_SIZE];
 uint16_t vs1053::bufferOffset;
 
 uint16_t vs1053::registers_backup[3];
+bool vs1053::isEncoderKept;
+bool vs1053::isEncoderLoaded;
+char vs1053::keptProfileName[13];
+const uint16_t* vs1053::keptProfile;
 
 //------------------------------------------------------------------------------
 /**
@@ -324,38 +708,131 @@ uint8_t vs1053::vs_init() {
  * - \ref Plug_Ins
  */
 uint8_t vs1053::VSLoadUserCode(const char* fileName){
-
-  union twobyte val;
-  union twobyte addr;
-  union twobyte n;
+  plugin_loader_m loader = {0, 0, 0, MP3_XCS, MP3_DREQ, false};
 
   if(!digitalRead(MP3_RESET)) return 3;
   if(isBusy()) return 1;
   if(!digitalRead(MP3_RESET)) return 3;
-  if (!track.open(fileName, O_READ)) return 2;
-  
-  while(1) {
-    if (!track.read(addr.byte, 2)) break;
-    if (!track.read(n.byte, 2)) break;
-    if (n.word & 0x8000U) { 
-      /* RLE run, replicate n samples */
-      n.word &= 0x7FFF;
-      if (!track.read(val.byte, 2)) break;
-      while (n.word--) {
-        Mp3WriteRegister(addr.word, val.word);
-      }
-    } else {
-      /* Copy run, copy n samples */
-      while(n.word--) {
-        if (!track.read(val.byte, 2)) break;
-        Mp3WriteRegister(addr.word, val.word);
-      }
+  return loadPluginFile(track, fileName, mp3DataBuffer, sizeof(mp3DataBuffer), &loader);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Load a plugin file to a VSdsp
+ *
+ * \param[in] file filehandle to read the plugin with.
+ * \param[in] fileName name of the plugin file.
+ * \param[in] buffer to read the plugin into, of an even size.
+ * \param[in] size of the buffer.
+ * \param[in,out] loader progress through the plugin, with the VSdsp's pins.
+ *
+ * Reads by buffers, rather than by word, setting up the SPI again after each
+ * read as it is shared with the SdCard.
+ *
+ * \return 0 when loaded, 2 when the file could not be opened.
+ */
+uint8_t vs1053::loadPluginFile(SdFile& file, const char* fileName, uint8_t* buffer, uint16_t size, plugin_loader_m* loader) {
+  int16_t n;
+
+  if (!file.open(fileName, O_READ)) return 2;
+  while ((n = file.read(buffer, size)) > 1) {
+    spiInit(true); // taken by the SdCard meanwhile
+    for (int16_t i = 0; i + 1 < n; i += 2) {
+      loadPluginWord(loader, ((uint16_t)buffer[i + 1]) << 8 | buffer[i]);
     }
+    releasePluginRun(loader); // before the SdCard takes the SPI again
   }
-  track.close(); 
+  file.close(); 
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief load VS1xxx with patch or plugin from flash.
+ *
+ * \param[in] plugin the plugin, in VLSI's compressed format, in PROGMEM.
+ * \param[in] words number of words of the plugin.
+ *
+ * Same as VSLoadUserCode(const char*), from the plugin arrays VLSI provides
+ * along with their .plg files. No file is opened, and the SPI is set up only
+ * once.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * - 0 indicates that upload was successful.
+ * - 1 indicates the upload can not be performed while currently streaming music.
+ * - 3 indicates that the VSdsp is in reset.
+ */
+uint8_t vs1053::VSLoadUserCode(const uint16_t* plugin, uint16_t words) {
+  plugin_loader_m loader = {0, 0, 0, MP3_XCS, MP3_DREQ, false};
+
+  if(!digitalRead(MP3_RESET)) return 3;
+  if(isBusy()) return 1;
+
+  spiInit(true);
+  while (words--) {
+    loadPluginWord(&loader, pgm_read_word(plugin++));
+  }
+  releasePluginRun(&loader); // in case the plugin is truncated
   return 0;
 }
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Load a word of a plugin
+ *
+ * \param[in,out] loader progress through the plugin.
+ * \param[in] word next word of the plugin.
+ *
+ * Writes each run of the plugin as one SCI multiple write, XCS held low while
+ * the write instruction and address are sent once, then the run's words as
+ * they come, waiting for DREQ before each. Without setting up the SPI again.
+ */
+void vs1053::loadPluginWord(plugin_loader_m* loader, uint16_t word) {
+  switch (loader->phase) {
+    case 0:
+      loader->address = word;
+      loader->phase = 1;
+      return;
+    case 1:
+      loader->left = word & 0x7FFF;
+      loader->phase = (word & 0x8000U) ? 2 : (loader->left ? 3 : 0);
+      return;
+  }
+
+  if (!loader->isSelected) {
+    while(!digitalRead(loader->dreq));
+    digitalWrite(loader->xcs, LOW);
+    SPI.transfer(0x02); // Write instruction
+    SPI.transfer(loader->address);
+    loader->isSelected = true;
+  }
+  /* RLE run replicates the word, copy run copies it */
+  do {
+    while(!digitalRead(loader->dreq));
+    SPI.transfer(word >> 8);
+    SPI.transfer(word & 0xFF);
+  } while (--loader->left && (loader->phase == 2));
+  if (!loader->left) {
+    releasePluginRun(loader);
+    loader->phase = 0;
+  }
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Pause the SCI multiple write of a plugin's run
+ *
+ * \param[in,out] loader progress through the plugin.
+ *
+ * Raises XCS, for the SPI to be used otherwise. The run then goes on with a
+ * new multiple write, to the same address, at its next word.
+ */
+void vs1053::releasePluginRun(plugin_loader_m* loader) {
+  if (!loader->isSelected) return;
+  digitalWrite(loader->xcs, HIGH);
+  loader->isSelected = false;
+}
+
 //------------------------------------------------------------------------------
 /**
  * \brief load VS1xxx image with patch or plugin from file on SDcard.
@@ -1075,11 +1552,12 @@ uint8_t vs1053::playTrack(uint8_t trackNo) {
  *
  * \param[out] fileName pointer of a char array (aka string), contianing the filename
  * \param[in] timecode (optional) milliseconds from the begining of the file.
- *  Only works with mp3 files, otherwise do nothing.
+ *  Only works with mp3 and wav files, otherwise do nothing.
  *
  * Skip, if already playing. Otherwise initialize the SdCard track to desired filehandle.
  * Reset the ByteRate and Play position and set playing to indicate such.
- * If the filename extension is MP3, then pre-read the byterate from the file.
+ * The format is sniffed from the content of the file, falling back to the
+ * filename extension, and the stream layout is pre-read with probeTrack().
  * And initially fill the VSDsp's buffer, then enable refilling.
  *
  * \return Any Value other than zero indicates a problem occured.
@@ -1099,6 +1577,7 @@ uint8_t vs1053::playTrack(uint8_t trackNo) {
  */
 uint8_t vs1053::play(char* fileName, uint32_t timecode) {
   if(isBusy()) return 1;
+  if (isEncoderLoaded) releaseEncoder();
   
   if (!isPatched) {
     VSLoadUserCode("patches.053");
@@ -1108,135 +1587,619 @@ uint8_t vs1053::play(char* fileName, uint32_t timecode) {
   
   /* Initialize track */
   if(!track.open(fileName, O_READ)) return 2;
-  trackFormat = getTrackFormat(fileName);
-  bufferOffset = sizeof(mp3DataBuffer);
-  isSkipping = false;
-  start_of_music = 0;
-  duration = 0;
-  if (trackFormat == ogg) {
-    /* OGG format support */
-    getOggInfo();
-  }
-  else if (trackFormat == mp3) {
-    /* 
-    Only know how to read bitrate from MP3 file. ignore the rest.
-    Note bitrate may get updated later by getAudioInfo() */
-    getBitRateFromMP3File();
-    if (timecode > 0) {
-      track.seekSet(timecode * bitrate + start_of_music); // skip to X ms.
-    }
-  }
-
-  Mp3WriteRegister(SCI_DECODE_TIME, 0); // Reset the decode time
-  Mp3WriteRegister(SCI_DECODE_TIME, 0);
-  playing_state = playback;
-  refill();
-  enableRefill();
-
-  return 0;
+  return startTrack(fileName, timecode);
 }
 
 //------------------------------------------------------------------------------
 /**
- * \brief Gracefully close track and cancel refill
+ * \brief Begin playing a file by its directory entry index.
  *
- * Skip if already not playing. Otherwise Disable the refill means,
- * then set playing to false, close the filehandle track instance.
- * And finally flush the VSdsp's stream buffer.
+ * \param[in] dirIndex index of the file's entry in the working directory, as
+ *  returned by findNextTrack() or kept in a catalog record.
+ * \param[in] timecode (optional) milliseconds from the begining of the file.
+ *  Only works with mp3 and wav files, otherwise do nothing.
+ *
+ * Same as play(char*, uint32_t), but the entry is read directly instead of
+ * searching the directory for the filename. So changing track costs the same
+ * in a folder of any size.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
  */
-void vs1053::stop(){
-  if (isBusy() != 0x01) return;
+uint8_t vs1053::play(uint16_t dirIndex, uint32_t timecode) {
+  //the short name, for the extension
+  char fileName[13];
 
-  bool isPaused = playing_state == paused_playback;
-  playing_state = cancelling;
-  if (isPaused) enableRefill(); // Stopping is processed by refill()
-  Serial.println(F("Stopping track"));
+  if(isBusy()) return 1;
+  if (isEncoderLoaded) releaseEncoder();
+
+  if (!isPatched) {
+    VSLoadUserCode("patches.053");
+    delay(1);
+    isPatched = true;
+  }
+  
+  /* Initialize track */
+  if(!track.open(sd.vwd(), dirIndex, O_READ)) return 2;
+  if (!track.isFile() || !track.getSFN(fileName)) {
+    track.close();
+    return 2;
+  }
+  return startTrack(fileName, timecode);
 }
 
-uint16_t vs1053::getRecordingLevel() {
-  return recordingLevel;
+//------------------------------------------------------------------------------
+/**
+ * \brief Find the next playable file of the working directory
+ *
+ * \param[in] dirIndex (optional) directory entry index to search after, -1
+ *  to search from the first entry.
+ *
+ * Enumerates the files in directory order, from the entry following dirIndex,
+ * without formatting filenames. Hidden files, and files whose extension is
+ * not of a format the VSdsp can decode, are skipped.
+ *
+ * \return the directory entry index of the file found, to be passed to
+ * play(uint16_t, uint32_t), or -1 when there is none.
+ */
+int32_t vs1053::findNextTrack(int32_t dirIndex) {
+  SdFile entry;
+  //the short name, for the extension
+  char fileName[13];
+  int32_t found = -1;
+  bool isHeld = holdRefill();
+
+  if (sd.vwd()->seekSet(32UL * (dirIndex + 1))) {
+    while ((found < 0) && entry.openNext(sd.vwd(), O_READ)) {
+      if (entry.isFile() && !entry.isHidden() && entry.getSFN(fileName) && \
+          (getTrackFormat(fileName) != unknownFormat)) {
+        found = entry.dirIndex();
+      }
+      entry.close();
+    }
+  }
+  releaseRefill(isHeld);
+  return found;
 }
 
+#if USE_TRACK_QUEUE
 //------------------------------------------------------------------------------
 /**
- * \brief Begin recording an OGG file
+ * \brief Queue the file to be played after the current track
  *
- * \param[in] fileName output file name.
- * \param[in] profileName profile name.
- * \param[in] isStereo stereo (true, 2 channels) or mono (false, 1 channel).
+ * \param[in] fileName pointer of a char array (aka string), contianing the filename
  *
- * 1. Backup and set registers
- * 2. Soft reset and disable interrupt except SCI
- * 3. Load profile (053 or img)
- * 4. Set recording related registers
- * 5. Open output file for writing
- * 6. Start recording
+ * The file is opened and probed now, while the current track plays. At its
+ * end, refill() carries on with the queued track itself. Between MP3 tracks
+ * the frames follow straight in the VSdsp's data stream, without end filling
+ * nor cancelling, for gapless playback. The ID3v1 tag of the first is left
+ * out, as its ID3v2 tag is for the second. Other formats are ended as usual,
+ * but the next track starts without waiting for play() to reopen it.
  *
- * \return Any Value other than zero indicates a problem occurred.
+ * Queueing again replaces the queued file. play() and stop() drop it.
+ *
+ * \return Any Value other than zero indicates a problem occured.
  * where value indicates specific error
  *
  * \see
  * \ref Error_Codes
+ *
+ * \note When nothing is playing, the file is played right away.
  */
-uint8_t vs1053::recordOgg(const char* fileName, const char* profileName, bool isStereo) {
-  if (isBusy()) return 1;
-  
-  playing_state = loading;
-  registers_backup[0] = Mp3ReadRegister(SCI_CLOCKF);
-  registers_backup[1] = Mp3ReadRegister(SCI_BASS);
-  registers_backup[2] = Mp3ReadRegister(SCI_MODE);
-  
-  Mp3WriteRegister(SCI_CLOCKF, 0xC000); // Set multiplier to 4.5x
-  delay(1);
-  Mp3WriteRegister(SCI_BASS, 0); // Clear bass
-  Mp3WriteRegister(SCI_MODE, ((registers_backup[2] | SM_RESET) & ~SM_ADPCM)); // Soft reset
-  delay(10);
-  isPatched = false;
-  Mp3WriteRegister(SCI_AIADDR, 0); 
-  Mp3WriteWRAM(para_interrupt, 0x02); // Disable all interrupts except SCI
-  
-#if defined(PROFILE_LOADER) && PROFILE_LOADER == IMG_LOADER
-  uint16_t addr;
-  if (VSLoadImage(profileName, &addr)) {
-#else
-  if (VSLoadUserCode(profileName)) {
-#endif
-    playing_state = ready;
-    Serial.print(F("Error: Load ")); Serial.print(profileName); Serial.println(F(" failed!"));
-    return 2;
-  }
-#if defined(PROFILE_LOADER) && PROFILE_LOADER == IMG_LOADER
-  Serial.print(F("Image at: $")); Serial.println(addr, HEX);
-#endif
+uint8_t vs1053::queueNext(char* fileName) {
+  uint8_t result;
+  bool isHeld = holdRefill();
 
-  int sciMODE;
-  if (isStereo) {
-    sciMODE = Mp3ReadRegister(SCI_MODE) | SM_ADPCM | SM_LAYER12;
-  } else {
-    sciMODE = Mp3ReadRegister(SCI_MODE) | SM_ADPCM;
+  if (isBusy() != 0x01) {
+    releaseRefill(isHeld);
+    return isBusy() ? 1 : play(fileName);
   }
-  isRecordingStereo = isStereo;
-  /* Set Input Mode to either Line1 or Microphone. */
-#if defined(VS_LINE1_MODE)
-  Mp3WriteRegister(SCI_MODE, (sciMODE | SM_LINE1));
-#else
-  Mp3WriteRegister(SCI_MODE, (sciMODE & ~SM_LINE1));
-#endif
-  Mp3WriteRegister(SCI_AICTRL1, 1024); // Recording gain 1x
-  Mp3WriteRegister(SCI_AICTRL2, 0); // Maximum AGC
-  Mp3WriteRegister(SCI_AICTRL3, 0);
+  if (nextTrack.isOpen()) nextTrack.close();
+  result = nextTrack.open(fileName, O_READ) ? queueTrack(fileName) : 2;
+  releaseRefill(isHeld);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Queue the file to be played after the current track, by its
+ * directory entry index.
+ *
+ * \param[in] dirIndex index of the file's entry in the working directory.
+ *
+ * Same as queueNext(char*), for entries found by findNextTrack().
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t vs1053::queueNext(uint16_t dirIndex) {
+  //the short name, for the extension
+  char fileName[13];
+  uint8_t result = 2;
+  bool isHeld = holdRefill();
+
+  if (isBusy() != 0x01) {
+    releaseRefill(isHeld);
+    return isBusy() ? 1 : play(dirIndex);
+  }
+  if (nextTrack.isOpen()) nextTrack.close();
+  if (nextTrack.open(sd.vwd(), dirIndex, O_READ)) {
+    if (nextTrack.isFile() && nextTrack.getSFN(fileName)) {
+      result = queueTrack(fileName);
+    } else {
+      nextTrack.close();
+    }
+  }
+  releaseRefill(isHeld);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Probe the queued track
+ *
+ * \param[in] fileName filename of the track, for the format to fall back on.
+ *
+ * Positions the queued track where play() would start it.
+ *
+ * \return zero, as the queued track is opened.
+ *
+ * \note The refill is expected to be held by the caller. The seek table is
+ * not read ahead, so skipping within a queued MP4 track is estimated.
+ */
+uint8_t vs1053::queueTrack(char* fileName) {
+  if (probeTrack(nextTrack, &nextMeta, &nextTag, borrowBuffer(), NULL) == unknownFormat) {
+    nextMeta.format = getTrackFormat(fileName);
+  }
+  if ((nextMeta.format != wav) && (nextMeta.format != wma)) {
+    nextTrack.seekSet(nextMeta.start); // right after any ID3v2 tag
+  }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Make the queued track the current one
+ *
+ * Called by refill() at the end of the current track, which is closed. So
+ * registers are written with sciWrite(), which does not pause the refill, and
+ * the refill is left enabled, or not, as it is.
+ */
+void vs1053::startQueued() {
+  track = nextTrack;
+  nextTrack.close(); // the copy now owns the file
+  meta = nextMeta;
+  tag = nextTag;
+  bufferOffset = sizeof(mp3DataBuffer);
+  sciWrite(SCI_DECODE_TIME, 0); // Reset the decode time
+  sciWrite(SCI_DECODE_TIME, 0);
+  sciWrite(SCI_WRAMADDR, para_positionMsec_0); // Not reset between MP3 frames
+  sciWrite(SCI_WRAM, 0);
+  sciWrite(SCI_WRAM, 0);
+  position = 0;
+  positionMsec = 0;
+  positionMsecAt = millis();
+  Serial.println(F("Next track"));
+}
+
+#endif // USE_TRACK_QUEUE
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Begin playing the opened track
+ *
+ * \param[in] fileName filename of the track, for the format to fall back on.
+ * \param[in] timecode milliseconds from the begining of the file.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \note The patches are expected to be loaded prior, as that reuses the track
+ * filehandle.
+ */
+uint8_t vs1053::startTrack(char* fileName, uint32_t timecode) {
+#if USE_TRACK_QUEUE
+  if (nextTrack.isOpen()) nextTrack.close(); // queued for the previous track
+#endif
+  if (probeTrack(track, &meta, &tag, mp3DataBuffer, seekTable) == unknownFormat) {
+    meta.format = getTrackFormat(fileName);
+  }
+  bufferOffset = sizeof(mp3DataBuffer);
+  isSkipping = false;
+  if (meta.format == mp3) {
+    /* 
+    Only know how to read bitrate from MP3 file. ignore the rest.
+    Note bitrate may get updated later by getAudioInfo() */
+    track.seekSet(timecode * meta.bitrate + meta.start); // skip to X ms.
+  }
+  else if ((meta.format == wav) && (timecode > 0) && meta.byteRate && (meta.start < sizeof(mp3DataBuffer))) {
+    /* WAV format support, exact byte rate from the RIFF header. The VSdsp
+    still needs the header, so the first buffer is the header followed by the
+    data at X ms. */
+    uint32_t offset = (timecode / 1000) * meta.byteRate + (timecode % 1000) * meta.byteRate / 1000;
+    track.read(mp3DataBuffer, meta.start);
+    if (track.seekSet(meta.start + offset - (offset % meta.blockAlign))) {
+      int16_t len = track.read(&mp3DataBuffer[meta.start], sizeof(mp3DataBuffer) - meta.start);
+      if (len == (int16_t)(sizeof(mp3DataBuffer) - meta.start)) {
+        bufferOffset = 0;
+      }
+    }
+    if (bufferOffset) track.seekSet(0); // beyond the data, play from the start
+  }
+  else if ((meta.format != wav) && (meta.format != wma)) {
+    track.seekSet(meta.start); // right after any ID3v2 tag
+  }
+  /* Otherwise the VSdsp parses the headers itself, so the timecode is
+  ignored. */
+
+  Mp3WriteRegister(SCI_DECODE_TIME, 0); // Reset the decode time
+  Mp3WriteRegister(SCI_DECODE_TIME, 0);
+  position = 0;
+  positionMsec = 0;
+  positionMsecAt = millis();
+#if USE_TRACK_QUEUE
+  playCount++;
+#endif
+  playing_state = playback;
+  refill();
+  enableRefill();
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Gracefully close track and cancel refill
+ *
+ * Skip if already not playing. Otherwise Disable the refill means,
+ * then set playing to false, close the filehandle track instance.
+ * And finally flush the VSdsp's stream buffer.
+ *
+ * A MP3 track resyncing after skipTo() is stopped as well, its volume and
+ * para_resync being restored.
+ */
+void vs1053::stop(){
+  if ((isBusy() != 0x01) && (playing_state != resyncing)) return;
+
+  bool isPaused = playing_state == paused_playback;
+  playing_state = cancelling;
+  if (isPaused) enableRefill(); // Stopping is processed by refill()
+  Serial.println(F("Stopping track"));
+}
+
+uint16_t vs1053::getRecordingLevel() {
+  return recordingLevel;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Get the statistics of the recording
+ *
+ * \param[out] stats to be updated with the statistics since recordOgg().
+ *
+ * Qualifies a SdCard for recording: overflows and lost words should stay at
+ * zero, with writeP99 well within the time the buffer takes to fill.
+ */
+void vs1053::getRecordingStats(record_stats_m* stats) {
+  uint32_t latency[RECORD_LATENCY_BUCKETS];
+  uint32_t total = 0;
+  uint32_t elapsed;
+  uint8_t i;
+
+  noInterrupts(); // updated by oggRefill(), possibly in an interrupt
+  *stats = recordStats;
+  memcpy(latency, writeLatency, sizeof(latency));
+  interrupts();
+
+  elapsed = millis() - recordStartedAt;
+  stats->bytesPerSecond = elapsed ? (uint64_t)stats->bytes * 1000 / elapsed : 0;
+  /* The bucket holding the 99th percentile write */
+  for (i = 0; i < RECORD_LATENCY_BUCKETS; i++) total += latency[i];
+  total -= total / 100;
+  for (i = 0; (i < RECORD_LATENCY_BUCKETS - 1) && (total > latency[i]); i++) total -= latency[i];
+  stats->writeP99 = (i < RECORD_LATENCY_BUCKETS - 1) ? 64UL << i : stats->writeMax;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Begin recording an OGG file
+ *
+ * \param[in] fileName output file name, or NULL to only send to the stream set by setRecordingStream().
+ * \param[in] profileName profile name.
+ * \param[in] isStereo stereo (true, 2 channels) or mono (false, 1 channel).
+ * \param[in] maxSize (optional) size to preallocate the file to, in bytes.
+ *
+ * 1. Backup and set registers
+ * 2. Soft reset and disable interrupt except SCI
+ * 3. Load profile (053 or img)
+ * 4. Set recording related registers
+ * 5. Open output file for writing
+ * 6. Start recording
+ *
+ * With a maxSize, the file is created contiguous to that size up front, and
+ * written by whole 512-byte blocks within a single multi-block write to the
+ * SdCard. So no cluster is allocated, nor directory entry updated, while
+ * recording. The file is truncated to the recorded length when finished, and
+ * the recording stops by itself RECORD_STOP_MARGIN before maxSize.
+ *
+ * As set by setRecordingRotation(), the recording switches to new files at
+ * page boundaries, each one starting with the header pages of the first.
+ * Rotation is only done without a maxSize, as copying the header pages needs
+ * the volume's cache.
+ *
+ * As set by setPreTrigger(), the recording starts armed. The header pages
+ * are written as soon as complete, the audio pages cycle through the ring
+ * until triggerRecord().
+ *
+ * As set by keepEncoder(), a recording with the same profile as the last
+ * one starts without loading it again.
+ *
+ * \return Any Value other than zero indicates a problem occurred.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ *
+ * \warning With a maxSize, the volume's cache is used as sector buffer, so no
+ * other file may be accessed until the recording is done.
+ */
+uint8_t vs1053::recordOgg(const char* fileName, const char* profileName, bool isStereo, uint32_t maxSize) {
+  return startOgg(fileName, profileName, NULL, 0, isStereo, maxSize);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Begin recording an OGG file, with a profile image in flash
+ *
+ * \param[in] fileName output file name, or NULL to only send to the stream set by setRecordingStream().
+ * \param[in] profile the profile, in VLSI's compressed plugin format, in PROGMEM.
+ * \param[in] words number of words of the profile.
+ * \param[in] isStereo stereo (true, 2 channels) or mono (false, 1 channel).
+ * \param[in] maxSize (optional) size to preallocate the file to, in bytes.
+ *
+ * Same as recordOgg(const char*, const char*, bool, uint32_t), but the profile
+ * is loaded from flash, without opening a file of the SdCard. As of the
+ * plugin arrays VLSI provides along with their .plg files.
+ *
+ * \return Any Value other than zero indicates a problem occurred.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t vs1053::recordOgg(const char* fileName, const uint16_t* profile, uint16_t words, bool isStereo, uint32_t maxSize) {
+  return startOgg(fileName, NULL, profile, words, isStereo, maxSize);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Begin recording an OGG file, with the profile from a file or flash
+ *
+ * \param[in] fileName output file name, or NULL.
+ * \param[in] profileName profile file name, or NULL when in flash.
+ * \param[in] profile the profile in PROGMEM, when no profileName.
+ * \param[in] words number of words of the profile in PROGMEM.
+ * \param[in] isStereo stereo (true, 2 channels) or mono (false, 1 channel).
+ * \param[in] maxSize size to preallocate the file to, in bytes, or zero.
+ *
+ * As kept by keepEncoder(), the same profile is not loaded again. The VSdsp
+ * is neither reset, nor its clock changed, the encoder is only restarted.
+ *
+ * \return as recordOgg().
+ */
+uint8_t vs1053::startOgg(const char* fileName, const char* profileName, const uint16_t* profile, uint16_t words, bool isStereo, uint32_t maxSize) {
+  uint32_t startedAt = micros();
+
+  if (isBusy()) return 1;
   
-  if(!track.open(fileName, O_CREAT | O_WRITE)) return 2; // Open the file in write mode.
+  if (isEncoderLoaded && \
+      (profileName ? !strcmp(profileName, keptProfileName) : (profile == keptProfile))) {
+    playing_state = loading;
+  } else {
+    if (isEncoderLoaded) releaseEncoder();
+    playing_state = loading;
+    registers_backup[0] = Mp3ReadRegister(SCI_CLOCKF);
+    registers_backup[1] = Mp3ReadRegister(SCI_BASS);
+    registers_backup[2] = Mp3ReadRegister(SCI_MODE);
+
+    if (registers_backup[0] != 0xC000) {
+      Mp3WriteRegister(SCI_CLOCKF, 0xC000); // Set multiplier to 4.5x
+      delay(1);
+    }
+    Mp3WriteRegister(SCI_BASS, 0); // Clear bass
+    Mp3WriteRegister(SCI_MODE, ((registers_backup[2] | SM_RESET) & ~SM_ADPCM)); // Soft reset
+    delay(10);
+    isPatched = false;
+    Mp3WriteRegister(SCI_AIADDR, 0); 
+    Mp3WriteWRAM(para_interrupt, 0x02); // Disable all interrupts except SCI
+
+    uint8_t result;
+    if (!profileName) {
+      result = VSLoadUserCode(profile, words);
+    } else {
+#if defined(PROFILE_LOADER) && PROFILE_LOADER == IMG_LOADER
+      uint16_t addr;
+      result = VSLoadImage(profileName, &addr);
+      if (!result) {
+        Serial.print(F("Image at: $")); Serial.println(addr, HEX);
+      }
+#else
+      result = VSLoadUserCode(profileName);
+#endif
+    }
+    if (result) {
+      playing_state = ready;
+      Serial.print(F("Error: Load ")); Serial.print(profileName ? profileName : "profile"); Serial.println(F(" failed!"));
+      return 2;
+    }
+    keptProfile = profile;
+    strncpy(keptProfileName, profileName ? profileName : "", sizeof(keptProfileName) - 1);
+    keptProfileName[sizeof(keptProfileName) - 1] = 0;
+  }
+
+  int sciMODE;
+  if (isStereo) {
+    sciMODE = Mp3ReadRegister(SCI_MODE) | SM_ADPCM | SM_LAYER12;
+  } else {
+    sciMODE = (Mp3ReadRegister(SCI_MODE) | SM_ADPCM) & ~SM_LAYER12;
+  }
+  isRecordingStereo = isStereo;
+  /* Set Input Mode to either Line1 or Microphone. */
+#if defined(VS_LINE1_MODE)
+  Mp3WriteRegister(SCI_MODE, (sciMODE | SM_LINE1));
+#else
+  Mp3WriteRegister(SCI_MODE, (sciMODE & ~SM_LINE1));
+#endif
+  Mp3WriteRegister(SCI_AICTRL1, 1024); // Recording gain 1x
+  Mp3WriteRegister(SCI_AICTRL2, 0); // Maximum AGC
+  Mp3WriteRegister(SCI_AICTRL3, 0);
+  
+  recordFormat = ogg;
+  recordHeaderSize = 0;
+  isRecordingPcm = false;
+  recordFileNo = 0;
+  oggPageAt = 0;
+  oggPageLeft = 0;
+  if (openRecorded(fileName, maxSize)) {
+    isEncoderLoaded = true; // to be released, or kept, from here
+    if (!isEncoderKept) releaseEncoder();
+    playing_state = ready;
+    return 2;
+  }
+  /* The header pages can't be copied while the volume's cache is borrowed */
+  isRotating = (rotateMsec || rotateBytes) && isRecordingFile && !isContiguous;
+  isArmed = ringSize > 0;
+  isTriggered = false;
+  ringTotal = 0;
+  ringCommitted = 0;
+  recordProduced = 0;
+  recordEmitted = 0;
+  isVoxActive = voxStartLevel && ((recordFormat == ogg) || isRecordingPcm);
+  isVoxPending = false;
+  isVoxClosing = false;
+  recordingPeak = 0;
 
   Mp3WriteRegister(SCI_AIADDR, 0x34); // Start recording
   delay(1);
   while(!digitalRead(MP3_DREQ));
+  drainedAt = micros();
+  isEncoderLoaded = false;
+  checkStartLatency(startedAt);
   
   playing_state = recording;
   enableRefill(true);
   return 0;
 }
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Begin recording a WAV file
+ *
+ * \param[in] fileName output file name, or NULL to only send to the stream set by setRecordingStream().
+ * \param[in] sampleRate (optional) in Hz, from 8000 to 48000.
+ * \param[in] isStereo (optional) stereo (true, 2 channels) or mono (false, 1 channel).
+ * \param[in] isAdpcm (optional) IMA ADPCM (true, 4 bits), or linear PCM (false, 16 bits).
+ * \param[in] maxSize (optional) size to preallocate the file to, in bytes.
+ *
+ * 1. Open output file for writing, with a placeholder RIFF header
+ * 2. Backup and set registers
+ * 3. Set recording related registers
+ * 4. Soft reset into recording mode, which starts recording
+ *
+ * Uses the VSdsp's own encoder, selected with SM_ADPCM, so no profile is
+ * loaded. The recorded data is drained by writeOggInLoop(), or its timer,
+ * as for recordOgg(). The sizes of the RIFF header are patched when the
+ * recording stops, ADPCM data being trimmed to whole blocks.
+ *
+ * As set by setRecordingRotation(), the recording switches to new files at
+ * block boundaries, each with its own header. With a maxSize, it also does
+ * so RECORD_STOP_MARGIN before a file is full, rather than stopping.
+ *
+ * As set by setPreTrigger(), the recording starts armed, its data cycling
+ * through the ring until triggerRecord().
+ *
+ * \return Any Value other than zero indicates a problem occurred.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ *
+ * \warning With a maxSize, the volume's cache is used as sector buffer, so no
+ * other file may be accessed until the recording is done.
+ */
+uint8_t vs1053::recordWav(const char* fileName, uint16_t sampleRate, bool isStereo, bool isAdpcm, uint32_t maxSize) {
+  uint32_t startedAt = micros();
+
+  if (isBusy()) return 1;
+  if ((sampleRate < 8000) || (sampleRate > 48000)) return 3;
+  if (isEncoderLoaded) releaseEncoder();
+
+  playing_state = loading;
+  recordFormat = wav;
+  recordSampleRate = sampleRate;
+  isRecordingStereo = isStereo;
+  isRecordingPcm = !isAdpcm;
+  recordHeaderSize = wavHeader(mp3DataBuffer, 0);
+  recordFileNo = 0;
+  isRotating = (rotateMsec || rotateBytes) && fileName;
+  if (openRecorded(fileName, maxSize)) {
+    playing_state = ready;
+    return 2;
+  }
+  if (!emitRecorded(mp3DataBuffer, recordHeaderSize)) {
+    closeRecorded();
+    playing_state = ready;
+    return 2;
+  }
+  isArmed = ringSize > 0;
+  isTriggered = false;
+  ringTotal = 0;
+  ringCommitted = 0;
+  recordProduced = 0;
+  recordEmitted = 0;
+  isVoxActive = voxStartLevel && ((recordFormat == ogg) || isRecordingPcm);
+  isVoxPending = false;
+  isVoxClosing = false;
+  recordingPeak = 0;
+
+  registers_backup[0] = Mp3ReadRegister(SCI_CLOCKF);
+  registers_backup[1] = Mp3ReadRegister(SCI_BASS);
+  registers_backup[2] = Mp3ReadRegister(SCI_MODE);
+
+  if (registers_backup[0] != 0xC000) {
+    Mp3WriteRegister(SCI_CLOCKF, 0xC000); // Set multiplier to 4.5x
+    delay(1);
+  }
+  Mp3WriteRegister(SCI_BASS, 0); // Clear bass
+  Mp3WriteRegister(SCI_AICTRL0, sampleRate);
+  Mp3WriteRegister(SCI_AICTRL1, 1024); // Recording gain 1x
+  Mp3WriteRegister(SCI_AICTRL2, 0); // Maximum AGC
+  /* Joint stereo or left channel, and linear PCM rather than IMA ADPCM */
+  Mp3WriteRegister(SCI_AICTRL3, (isStereo ? 0 : 2) | (isAdpcm ? 0 : _BV(2)));
+
+  uint16_t sciMODE = (registers_backup[2] & ~SM_LINE1) | SM_ADPCM | SM_RESET;
+  /* Set Input Mode to either Line1 or Microphone. */
+#if defined(VS_LINE1_MODE)
+  sciMODE |= SM_LINE1;
+#endif
+  Mp3WriteRegister(SCI_MODE, sciMODE); // Soft reset, starting to record
+  delay(1);
+  while(!digitalRead(MP3_DREQ));
+  isPatched = false;
+  drainedAt = micros();
+  checkStartLatency(startedAt);
+
+  playing_state = recording;
+  enableRefill(true);
+  return 0;
+}
+
 //------------------------------------------------------------------------------
 /**
  * \brief Write recording data to file which should be called periodically  
@@ -1252,6 +2215,9 @@ uint8_t vs1053::recordOgg(const char* fileName, const char* profileName, bool is
  *    a. Close the file  
  *    b. Soft reset and restore registers 
  *
+ * When polled, calls return early until the period scheduled by the last
+ * drain elapsed.
+ *
  * \return Any Value other than zero indicates a problem occurred.
  * where value indicates specific error
  *
@@ -1261,6 +2227,10 @@ uint8_t vs1053::recordOgg(const char* fileName, const char* profileName, bool is
 uint8_t vs1053::writeOggInLoop() {
   uint8_t busy = isBusy();
   if ((busy != 0x02) && (busy != 0x04)) return 1;
+#if !defined(OGG_REFILL_USING_TIMER)
+  /* Polled, as scheduled by the last drain */
+  if ((busy == 0x02) && (micros() - drainedAt < recordStats.period)) return 0;
+#endif
   return oggRefill();
 }
 
@@ -1277,15 +2247,39 @@ uint8_t vs1053::oggRefill() {
   uint16_t written = 0;
   uint16_t waiting = Mp3ReadRegister(SCI_HDAT1);
   // Serial.print("waiting: "); Serial.println(waiting);
+
+  if (isArmed && isTriggered && ringSize) {
+    isArmed = false;
+    if (!commitRing()) {
+      Serial.println(F("Error: pre-trigger ring too small"));
+      finished = true;
+      result = 2;
+    }
+  }
   
-  while (waiting >= (sizeof(mp3DataBuffer) >> 1)) {
-    for (uint16_t addr = 0; addr < sizeof(mp3DataBuffer); addr += 2) {
-      union twobyte sciHDAT0;
-      sciHDAT0.word = Mp3ReadRegister(SCI_HDAT0);
-      mp3DataBuffer[addr] = sciHDAT0.byte[1]; 
-      mp3DataBuffer[addr + 1] = sciHDAT0.byte[0];
-    }
-    if (!track.write(mp3DataBuffer, sizeof(mp3DataBuffer))) {
+  while (!finished && (waiting >= (sizeof(mp3DataBuffer) >> 1))) {
+    uint16_t split = sizeof(mp3DataBuffer);
+    readHdat0(mp3DataBuffer, sizeof(mp3DataBuffer) >> 1, isRecordingPcm);
+    if (isRotating || isArmed || isVoxActive || recordStream) split = recordSplit(mp3DataBuffer, sizeof(mp3DataBuffer));
+    if (isRecordingPcm) {
+      for (uint16_t i = 0; i < sizeof(mp3DataBuffer); i += 2) {
+        int16_t sample = (int16_t)(((uint16_t)mp3DataBuffer[i + 1]) << 8 | mp3DataBuffer[i]);
+        uint16_t peak = (sample < 0) ? -(int32_t)sample : sample;
+        if (peak > recordingPeak) recordingPeak = peak;
+      }
+    }
+    if (split < sizeof(mp3DataBuffer)) {
+      /* Store up to the boundary, then rotate, arm or disarm as due */
+      if ((split && !storeRecorded(mp3DataBuffer, split)) || !switchRecorded()) {
+        Serial.println(F("Error: switching file failed when recording"));
+        finished = true;
+        result = 2;
+        break;
+      }
+    } else {
+      split = 0;
+    }
+    if (!storeRecorded(&mp3DataBuffer[split], sizeof(mp3DataBuffer) - split)) {
       Serial.println(F("Error: write OGG failed when recording"));
       finished = true; 
       result = 2;
@@ -1293,12 +2287,36 @@ uint8_t vs1053::oggRefill() {
     }
     written += sizeof(mp3DataBuffer);
     waiting -= (sizeof(mp3DataBuffer) >> 1);
+    recordProduced += sizeof(mp3DataBuffer);
 #if DEBUG
     cntWork++;
 #endif
   }
+  scheduleDrain(waiting + (written >> 1), waiting);
+  if (recordStream) drainStream(false);
   
-  if (playing_state == finishing) {
+  if (isContiguous && !isRotating && (playing_state == recording) && \
+      ((recordEndBlock + 1 - recordBlock) * 512UL < (uint32_t)RECORD_STOP_MARGIN + sectorFill)) {
+    Serial.println(F("Recording file is full"));
+    playing_state = finishing;
+  }
+
+  if ((playing_state == finishing) && (recordFormat == wav)) {
+    /* The VSdsp's encoder has no stop request, take what is left */
+    waiting = finished ? 0 : Mp3ReadRegister(SCI_HDAT1);
+    while (waiting > 0) {
+      uint16_t words = (waiting > (sizeof(mp3DataBuffer) >> 1)) ? (sizeof(mp3DataBuffer) >> 1) : waiting;
+      readHdat0(mp3DataBuffer, words, isRecordingPcm);
+      if (!storeRecorded(mp3DataBuffer, words << 1)) {
+        Serial.println(F("Error: write WAV failed when finishing"));
+        result = 2;
+        break;
+      }
+      written += words << 1;
+      waiting -= words;
+    }
+    finished = true;
+  } else if (playing_state == finishing) {
     Mp3WriteRegister(SCI_AICTRL3, Mp3ReadRegister(SCI_AICTRL3) | _BV(0)); // Stop
     while (!finished) {
       if (Mp3ReadRegister(SCI_AICTRL3) & _BV(1)) {
@@ -1318,12 +2336,8 @@ uint8_t vs1053::oggRefill() {
           size = waiting << 1;
         }
         
-        for (addr = 0; addr < size; addr += 2) {
-          union twobyte sciHDAT0;
-          sciHDAT0.word = Mp3ReadRegister(SCI_HDAT0);
-          mp3DataBuffer[addr] = sciHDAT0.byte[1]; 
-          mp3DataBuffer[addr + 1] = sciHDAT0.byte[0];
-        }
+        readHdat0(mp3DataBuffer, size >> 1);
+        addr = size;
         /* last word */
         if (finished && waiting <= (sizeof(mp3DataBuffer) >> 1)) {
           union twobyte sciHDAT0;
@@ -1339,7 +2353,7 @@ uint8_t vs1053::oggRefill() {
           // Serial.print("waiting3: "); Serial.println(waiting);
           // Serial.print("size: "); Serial.println(size);
         }
-        if (!track.write(mp3DataBuffer, size)) {
+        if (!storeRecorded(mp3DataBuffer, size)) {
           Serial.println(F("Error: write OGG failed when finishing"));
           finished = true; 
           result = 2;
@@ -1355,71 +2369,826 @@ uint8_t vs1053::oggRefill() {
       }
     }
   }
-  
-  /* Get position */
-  position = Mp3ReadWRAM(para_recordingTime_0, true);
-  /* Get recording level */
-  switch (readRecordingLevel) {
-    default:
-    case 0:
-      Mp3WriteRegister(SCI_AICTRL0, mask);
-      millis_prv = millis();
-      readRecordingLevel = 1;
-      break;
-    case 1:
-      {
-        unsigned long millis_cur = millis();
-        if ((millis_cur - millis_prv) >= 25) { // Waiting at least 1/50 second
-          uint16_t temp = Mp3ReadRegister(SCI_AICTRL0);
-          if (!(temp & mask)) {
-            recordingLevel = temp;
-          }
-          millis_prv = millis_cur;
-          readRecordingLevel = 2;
-        }
-      }
-      break;
-    case 2:
-      {
-        unsigned long millis_cur = millis();
-        if ((millis_cur - millis_prv) >= 500) { // Waiting at least 1/2 second
-          readRecordingLevel = 0;
-        }
+  
+  /* Get position */
+  if (recordFormat == wav) {
+    /* Derived from the samples recorded, in milliseconds as recordingTime */
+    uint16_t blockAlign = (isRecordingStereo ? 2 : 1) * (isRecordingPcm ? 2 : 256);
+    uint32_t samples = recordProduced / blockAlign * (isRecordingPcm ? 1 : 505);
+    position = (uint64_t)samples * 1000 / recordSampleRate;
+  } else {
+    position = Mp3ReadWRAM(para_recordingTime_0, true);
+  }
+  /* Get recording level */
+  if (recordFormat == wav) {
+    /* The VSdsp's encoder gives none, PCM samples give their peak */
+    if (millis() - millis_prv >= (isVoxActive ? VOX_LEVEL_PERIOD : RECORD_LEVEL_PERIOD)) {
+      recordingLevel = recordingPeak;
+      recordingPeak = 0;
+      millis_prv = millis();
+      updateVoiceActivation();
+    }
+  } else switch (readRecordingLevel) {
+    default:
+    case 0:
+      Mp3WriteRegister(SCI_AICTRL0, mask);
+      millis_prv = millis();
+      readRecordingLevel = 1;
+      break;
+    case 1:
+      {
+        unsigned long millis_cur = millis();
+        if ((millis_cur - millis_prv) >= 25) { // Waiting at least 1/50 second
+          uint16_t temp = Mp3ReadRegister(SCI_AICTRL0);
+          if (!(temp & mask)) {
+            recordingLevel = temp;
+            updateVoiceActivation();
+          }
+          millis_prv = millis_cur;
+          readRecordingLevel = 2;
+        }
+      }
+      break;
+    case 2:
+      {
+        unsigned long millis_cur = millis();
+        if ((millis_cur - millis_prv) >= (isVoxActive ? VOX_LEVEL_PERIOD : RECORD_LEVEL_PERIOD)) {
+          readRecordingLevel = 0;
+        }
+      }
+      break;
+  }
+  
+  if (finished) {
+    disableRefill(true);
+    if (recordStream) drainStream(true);
+    closeRecorded(); // Close out this track
+    
+    if (isEncoderKept && (recordFormat == ogg)) {
+      isEncoderLoaded = true; // for the next recordOgg()
+    } else {
+      releaseEncoder();
+    }
+    
+    playing_state = ready;
+    Serial.println(F("recording done"));
+  }
+  
+  // Serial.print("written: "); Serial.println(written);
+#if DEBUG
+  if(position2 != position) {
+    Serial.print(F("position ")); Serial.println(position);
+    Serial.print(F("recordingLevel ")); Serial.println(recordingLevel);
+    Serial.print(F("cntIsr ")); Serial.println(cntIsr);
+    Serial.print(F("cntWork ")); Serial.println(cntWork);
+    Serial.print(F("rate ")); Serial.println(1.0 * cntWork / cntIsr * 100);
+    cntIsr = 0;
+    cntWork = 0;
+  }
+#endif
+  return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Schedule the next drain of the recording buffer
+ *
+ * \param[in] waiting words found waiting by this drain.
+ * \param[in] left words left waiting after it.
+ *
+ * Estimates the encoder's output rate from the words added since the last
+ * drain, smoothed over a few drains. Then schedules the next drain for when
+ * RECORD_TARGET_FILL words are expected to be waiting.
+ *
+ * Finding RECORD_OVERFLOW_WORDS or more waiting counts as an overflow. The
+ * words the encoder produced beyond the buffer's size, at the rate estimated
+ * before, count as lost.
+ */
+void vs1053::scheduleDrain(uint16_t waiting, uint16_t left) {
+  uint32_t now = micros();
+  uint32_t elapsed = now - drainedAt;
+  uint32_t period = recordStats.period;
+  uint16_t margin;
+
+  if ((waiting >= RECORD_OVERFLOW_WORDS) && drainRate) {
+    /* Words the encoder produced but the buffer may not have held */
+    uint32_t expected = ((uint64_t)drainRate * elapsed) >> 16;
+    recordStats.overflows++;
+    if (expected + drainLeft > RECORD_FIFO_WORDS) recordStats.lostWords += expected + drainLeft - RECORD_FIFO_WORDS;
+  }
+  if (elapsed && (waiting >= drainLeft)) {
+    uint32_t rate = ((uint32_t)(waiting - drainLeft) << 16) / elapsed;
+    drainRate = drainRate ? (drainRate * 3 + rate) >> 2 : rate;
+  }
+  drainedAt = now;
+  drainLeft = left;
+  if (drainRate) {
+    period = ((uint32_t)((left < RECORD_TARGET_FILL) ? RECORD_TARGET_FILL - left : 0) << 16) / drainRate;
+    if (period < OGG_REFILL_MIN_PERIOD) period = OGG_REFILL_MIN_PERIOD;
+    if (period > OGG_REFILL_MAX_PERIOD) period = OGG_REFILL_MAX_PERIOD;
+  }
+#if defined(OGG_REFILL_USING_TIMER)
+  if (period != recordStats.period) Timer1.setPeriod(period);
+#endif
+
+  recordStats.drains++;
+  recordStats.period = period;
+  if (waiting > recordStats.maxWaiting) recordStats.maxWaiting = waiting;
+  margin = (waiting < RECORD_FIFO_WORDS) ? RECORD_FIFO_WORDS - waiting : 0;
+  if (margin < recordStats.minMargin) recordStats.minMargin = margin;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Open the file to be recorded
+ *
+ * \param[in] fileName output file name, or NULL to only stream.
+ * \param[in] maxSize size to preallocate the file to, in bytes, or zero.
+ *
+ * Opens the file as told by recordOgg(), if any. The first file of a
+ * recording also resets the recording statistics and the stream's queue,
+ * the next ones continue them.
+ *
+ * \return zero when the file is ready to be written.
+ */
+uint8_t vs1053::openRecorded(const char* fileName, uint32_t maxSize) {
+  isRecordingFile = fileName != NULL;
+  if (isRecordingFile && !recordFileNo && (strlen(fileName) >= sizeof(recordName))) return 2;
+  isContiguous = isRecordingFile && (maxSize > 0);
+  recordLength = 0;
+  sectorFill = 0;
+  recordFileAt = millis();
+  if (isContiguous) {
+    sd.remove(fileName); // createContiguous() needs a new file
+    if (!track.createContiguous(sd.vwd(), fileName, maxSize) || \
+        !track.contiguousRange(&recordBlock, &recordEndBlock)) return 2;
+    /* cacheClear() fails, returning NULL, if a dirty block can't be written */
+    cache_t* cache = sd.vol()->cacheClear();
+    if (!cache || \
+        !sd.card()->writeStart(recordBlock, recordEndBlock - recordBlock + 1)) {
+      track.close();
+      return 2;
+    }
+    sectorBuffer = cache->data;
+  } else if(isRecordingFile && !track.open(fileName, O_CREAT | O_WRITE)) return 2; // Open the file in write mode.
+  if (recordFileNo) return 0;
+
+  strncpy(recordName, isRecordingFile ? fileName : "", sizeof(recordName) - 1);
+  recordName[sizeof(recordName) - 1] = 0;
+  recordMaxSize = maxSize;
+  memset(&recordStats, 0, sizeof(recordStats));
+  memset(writeLatency, 0, sizeof(writeLatency));
+  recordStartedAt = millis();
+  recordStats.minMargin = RECORD_FIFO_WORDS;
+  recordStats.period = OGG_REFILL_PERIOD;
+  drainRate = 0;
+  drainLeft = 0;
+  streamHead = 0;
+  streamQueued = 0;
+  isStreamDropping = false;
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Write recorded data to the file
+ *
+ * \param[in] buf recorded data.
+ * \param[in] size number of bytes.
+ *
+ * Contiguous recordings gather the data into whole blocks, each sent with
+ * the multi-block write started by recordOgg(). The latency of each write is
+ * accounted into the recording statistics.
+ *
+ * \return true when the data was written.
+ */
+bool vs1053::writeRecorded(const uint8_t* buf, uint16_t size) {
+  uint32_t started = micros();
+  uint32_t latency;
+  uint16_t length = size;
+  uint8_t bucket = 0;
+  bool isWritten = true;
+
+  if (!isContiguous) {
+    isWritten = track.write(buf, size) == size;
+    if (isWritten) recordLength += size;
+  } else {
+    while (isWritten && size) {
+      uint16_t n = 512 - sectorFill;
+      if (n > size) n = size;
+      memcpy(&sectorBuffer[sectorFill], buf, n);
+      sectorFill += n;
+      recordLength += n;
+      buf += n;
+      size -= n;
+      if (sectorFill == 512) {
+        isWritten = (recordBlock <= recordEndBlock) && sd.card()->writeData(sectorBuffer);
+        recordBlock++;
+        sectorFill = 0;
+      }
+    }
+  }
+
+  latency = micros() - started;
+  for (uint32_t t = latency >> 6; t && (bucket < RECORD_LATENCY_BUCKETS - 1); t >>= 1) bucket++;
+  writeLatency[bucket]++;
+  if (latency > recordStats.writeMax) recordStats.writeMax = latency;
+  if (isWritten) recordStats.bytes += length;
+  return isWritten;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Assemble the RIFF header of a WAV recording
+ *
+ * \param[out] buf buffer of at least 60 bytes, to be filled with the header.
+ * \param[in] dataLength size of the "data" chunk, zero until known.
+ *
+ * IMA ADPCM as encoded by the VSdsp comes in blocks of 256 bytes per channel,
+ * each of 505 samples, and needs a "fact" chunk with the number of samples.
+ * Linear PCM is 16 bits per sample.
+ *
+ * \return size of the header.
+ */
+uint16_t vs1053::wavHeader(uint8_t* buf, uint32_t dataLength) {
+  uint8_t channels = isRecordingStereo ? 2 : 1;
+  uint16_t blockAlign = isRecordingPcm ? channels * 2 : channels * 256;
+  uint16_t size = isRecordingPcm ? 44 : 60;
+  uint8_t* p = buf + 12;
+
+  memcpy(buf, "RIFF", 4);
+  setLe(&buf[4], size - 8 + dataLength, 4);
+  memcpy(&buf[8], "WAVE", 4);
+  memcpy(p, "fmt ", 4);
+  setLe(&p[4], isRecordingPcm ? 16 : 20, 4);
+  setLe(&p[8], isRecordingPcm ? 0x0001 : 0x0011, 2); // PCM or IMA ADPCM
+  setLe(&p[10], channels, 2);
+  setLe(&p[12], recordSampleRate, 4);
+  setLe(&p[16], isRecordingPcm ? (uint32_t)recordSampleRate * blockAlign : (uint32_t)recordSampleRate * blockAlign / 505, 4);
+  setLe(&p[20], blockAlign, 2);
+  setLe(&p[22], isRecordingPcm ? 16 : 4, 2);
+  p += 24;
+  if (!isRecordingPcm) {
+    setLe(p, 2, 2); // cbSize
+    setLe(&p[2], 505, 2); // samples per block
+    memcpy(&p[4], "fact", 4);
+    setLe(&p[8], 4, 4);
+    setLe(&p[12], dataLength / blockAlign * 505, 4);
+    p += 16;
+  }
+  memcpy(p, "data", 4);
+  setLe(&p[4], dataLength, 4);
+  return size;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Close the recorded file
+ *
+ * Contiguous recordings have their last block padded and written, the
+ * multi-block write ended, and the file truncated to the recorded length.
+ *
+ * WAV recordings have the sizes of their header patched. IMA ADPCM ones are
+ * truncated to whole blocks.
+ */
+void vs1053::closeRecorded() {
+  uint32_t length = recordLength;
+
+  if (!isRecordingFile) return;
+  if (isContiguous) {
+    if (sectorFill && (recordBlock <= recordEndBlock)) {
+      memset(&sectorBuffer[sectorFill], 0, 512 - sectorFill);
+      sd.card()->writeData(sectorBuffer);
+    }
+    sd.card()->writeStop();
+    sd.vol()->cacheClear(); // the cache held recorded data, not a block
+  }
+  if (recordFormat == wav) {
+    uint8_t header[60]; // mp3DataBuffer may hold data of the next file
+    uint32_t dataLength = (length > recordHeaderSize) ? length - recordHeaderSize : 0;
+
+    if (!isRecordingPcm) dataLength -= dataLength % (isRecordingStereo ? 512 : 256);
+    length = recordHeaderSize + dataLength;
+    track.seekSet(0);
+    track.write(header, wavHeader(header, dataLength));
+  }
+  if (isContiguous || (recordFormat == wav)) track.truncate(length);
+  isContiguous = false;
+  track.close();
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Name a file of the recording
+ *
+ * \param[out] name buffer of RECORD_PATH_LENGTH + 3 characters.
+ * \param[in] number of the file, from 0 for the first one to 999.
+ *
+ * The next files take the first one's path, its base name cut to 5
+ * characters followed by their 3 digits number, e.g. "REC/LOG.OGG",
+ * "REC/LOG001.OGG", "REC/LOG002.OGG"... So 8.3 names stay 8.3.
+ */
+void vs1053::recordFileName(char* name, uint16_t number) {
+  const char* base = strrchr(recordName, '/');
+  const char* ext;
+  uint8_t length;
+
+  strcpy(name, recordName);
+  if (!number) return;
+  base = base ? base + 1 : recordName;
+  ext = strrchr(base, '.');
+  length = ext ? ext - base : strlen(base);
+  if (length > 5) length = 5;
+  sprintf(&name[base - recordName + length], "%03u%s", number, ext ? ext : "");
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Find where the recording may switch file, or be gated
+ *
+ * \param[in] buf recorded data, yet to be written.
+ * \param[in] size number of bytes.
+ *
+ * WAV data is split where the encoder produced a whole number of blocks,
+ * which are never larger than a drain. Ogg data at a page boundary.
+ *
+ * \return offset in buf of the first byte after a boundary, or size if none.
+ */
+uint16_t vs1053::recordSplit(const uint8_t* buf, uint16_t size) {
+  if (recordFormat == ogg) return oggPageStart(buf, size);
+
+  uint16_t blockAlign = (isRecordingStereo ? 2 : 1) * (isRecordingPcm ? 2 : 256);
+  return (recordProduced % blockAlign) ? size : 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Follow the Ogg pages recorded
+ *
+ * \param[in] buf recorded data, yet to be written.
+ * \param[in] size number of bytes.
+ *
+ * Parses the headers of the pages going through, skipping their bodies. The
+ * first page with a granule position marks the end of the Vorbis header
+ * pages, whose size is kept as recordHeaderSize.
+ *
+ * \return offset in buf of the first audio page starting in it, or size if none.
+ */
+uint16_t vs1053::oggPageStart(const uint8_t* buf, uint16_t size) {
+  uint16_t start = size;
+
+  for (uint16_t i = 0; i < size; i++) {
+    if (oggPageLeft && !oggPageAt) {
+      /* Skip the page's body */
+      uint16_t n = size - i;
+      if (n > oggPageLeft) n = oggPageLeft;
+      oggPageLeft -= n;
+      i += n - 1;
+      continue;
+    }
+    if (oggPageAt == 0) {
+      if (recordHeaderSize && (start == size)) start = i;
+      oggPageOffset = recordProduced + i; // from the start of the recording
+      isOggAudio = false;
+    }
+    if ((oggPageAt >= 6) && (oggPageAt <= 13) && buf[i]) isOggAudio = true; // granule position
+    if ((oggPageAt == 13) && isOggAudio && !recordHeaderSize) recordHeaderSize = oggPageOffset;
+    if (oggPageAt == 26) {
+      oggSegments = buf[i];
+    } else if (oggPageAt > 26) {
+      oggPageLeft += buf[i]; // lacing values
+    }
+    oggPageAt++;
+    if ((oggPageAt > 26) && (oggPageAt == 27 + oggSegments)) oggPageAt = 0;
+  }
+  return start;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Tell if the recording is due to switch to a new file
+ *
+ * \return true once the current file is as long or large as set by
+ * setRecordingRotation(), or contiguous and nearly full.
+ */
+bool vs1053::isRotationDue() {
+  if (rotateMsec && (millis() - recordFileAt >= rotateMsec)) return true;
+  if (rotateBytes && (recordLength >= rotateBytes)) return true;
+  return isContiguous && \
+    ((recordEndBlock + 1 - recordBlock) * 512UL < (uint32_t)RECORD_STOP_MARGIN + sectorFill);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Switch the recording to a new file
+ *
+ * Closes the current file, then opens the next one and writes its header.
+ * A WAV's own, or the header pages of the first Ogg file. The encoder keeps
+ * running meanwhile.
+ *
+ * \return Any Value other than zero indicates a problem occurred.
+ */
+uint8_t vs1053::rotateRecorded() {
+  char name[RECORD_PATH_LENGTH + 3];
+  uint8_t header[60];
+  SdFile first; // nextTrack may hold a queued track
+
+  closeRecorded();
+  recordFileName(name, ++recordFileNo);
+  sd.remove(name);
+  if (openRecorded(name, recordMaxSize)) return 2;
+
+  if (recordFormat == wav) return writeRecorded(header, wavHeader(header, 0)) ? 0 : 2;
+
+  recordFileName(name, 0);
+  if (!first.open(name, O_READ)) return 2;
+  for (uint16_t left = recordHeaderSize; left; ) {
+    uint16_t n = (left > sizeof(header)) ? sizeof(header) : left;
+    if ((first.read(header, n) != n) || !writeRecorded(header, n)) {
+      first.close();
+      return 2;
+    }
+    left -= n;
+  }
+  first.close();
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Store recorded data
+ *
+ * \param[in] buf recorded data.
+ * \param[in] size number of bytes.
+ *
+ * Written to the file, or to the ring while armed, or discarded when armed
+ * without a ring. The Ogg header pages are written from the ring once
+ * complete, hence the ring must hold them.
+ *
+ * \return true when the data was stored.
+ */
+bool vs1053::storeRecorded(const uint8_t* buf, uint16_t size) {
+  if (!isArmed) return emitRecorded(buf, size);
+  if (!ringSize) {
+    ringTotal += size; // discarded
+    return true;
+  }
+
+  while (size) {
+    uint16_t at = ringTotal % ringSize;
+    uint16_t n = ringSize - at;
+    if (n > size) n = size;
+    memcpy(&ringBuffer[at], buf, n);
+    ringTotal += n;
+    buf += n;
+    size -= n;
+  }
+  if ((recordFormat == ogg) && recordHeaderSize && !recordEmitted) {
+    /* Once per recording, to the file or the stream */
+    if (ringTotal > ringSize) return false;
+    return emitRecorded(ringBuffer, recordHeaderSize);
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Write the ring of an armed recording to the file
+ *
+ * Writes from the oldest block, or Ogg page, still in the ring up to the
+ * latest data, so the recording goes on seamlessly from there.
+ *
+ * \return true when written, false when the ring did not hold a whole
+ * block or page, or the write failed.
+ */
+bool vs1053::commitRing() {
+  uint32_t oldest = (ringTotal > ringSize) ? ringTotal - ringSize : 0;
+
+  recordFileAt = millis();
+  if (oldest < ringCommitted) oldest = ringCommitted;
+  if (recordFormat == wav) {
+    uint16_t blockAlign = (isRecordingStereo ? 2 : 1) * (isRecordingPcm ? 2 : 256);
+    oldest += (blockAlign - (oldest - ringCommitted) % blockAlign) % blockAlign;
+  } else if (!recordHeaderSize) {
+    /* The header pages are not even complete, keep everything */
+    if (oldest) return false;
+  } else {
+    /* Find the capture pattern of the oldest page */
+    if (oldest < recordHeaderSize) oldest = recordHeaderSize;
+    while ((oldest + 4 <= ringTotal) && \
+           ((ringBuffer[oldest % ringSize] != 'O') || \
+            (ringBuffer[(oldest + 1) % ringSize] != 'g') || \
+            (ringBuffer[(oldest + 2) % ringSize] != 'g') || \
+            (ringBuffer[(oldest + 3) % ringSize] != 'S'))) oldest++;
+    if (oldest + 4 > ringTotal) return false;
+  }
+  if (oldest > ringTotal) return false;
+
+  while (oldest < ringTotal) {
+    uint16_t at = oldest % ringSize;
+    uint16_t n = ringSize - at;
+    if (n > ringTotal - oldest) n = ringTotal - oldest;
+    if (!emitRecorded(&ringBuffer[at], n)) return false;
+    oldest += n;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Set a ring for pre-trigger capture
+ *
+ * \param[in] ring buffer, to be kept for as long as recordings use it.
+ * \param[in] size of the ring in bytes, zero for none.
+ *
+ * Applies to the next recordOgg() or recordWav(), which then start armed.
+ * The encoder runs, but its output only cycles through the ring. On
+ * triggerRecord() the ring's content, from its oldest ADPCM block or Ogg
+ * page, is written to the file, followed by everything recorded after.
+ *
+ * The ring holds the last size / byte rate seconds before the trigger, e.g.
+ * 4055 bytes per second for mono IMA ADPCM at 8 kHz. For Ogg, it must also
+ * hold the header pages, of a few kilobytes.
+ */
+void vs1053::setPreTrigger(uint8_t* ring, uint16_t size) {
+  ringBuffer = ring;
+  ringSize = ring ? size : 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Trigger an armed recording
+ *
+ * The ring is written to the file by the next drain, from writeOggInLoop()
+ * or its timer. Stopping an armed recording triggers it as well.
+ */
+void vs1053::triggerRecord() {
+  if (isBusy() != 0x02) return;
+
+  isTriggered = true;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Switch the recording at a page or block boundary
+ *
+ * Disarms a triggered recording without a ring, arms one whose voice
+ * activated gate closes, or rotates the file when due. Rotating stops after
+ * the 999th file, the recording carrying on in it. A stream dropping data
+ * resumes from there.
+ *
+ * \return true unless switching file failed.
+ */
+bool vs1053::switchRecorded() {
+  isStreamDropping = false;
+  if (isArmed) {
+    if (isTriggered && !ringSize) {
+      isArmed = false;
+      recordFileAt = millis();
+    }
+    return true;
+  }
+  if (isVoxClosing) {
+    isVoxClosing = false;
+    isTriggered = false;
+    isArmed = true;
+    ringCommitted = ringTotal;
+    return true;
+  }
+  if (!isRotating || !isRotationDue()) return true;
+  if (recordFileNo >= 999) {
+    /* Out of numbers, rather than overwriting the first files */
+    Serial.println(F("Warning: recording rotation stopped at 999 files"));
+    isRotating = false;
+    return true;
+  }
+  return !rotateRecorded();
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Follow the recording level with the voice activated gate
+ *
+ * Called on each new recordingLevel. The gate opens once the level stayed
+ * at or above the start level for the attack time, triggering the armed
+ * recording. It closes once the level stayed below the stop level for the
+ * hang time, arming the recording again.
+ */
+void vs1053::updateVoiceActivation() {
+  uint32_t now = millis();
+  bool isCalling = isArmed ? (recordingLevel >= voxStartLevel) : (recordingLevel < voxStopLevel);
+
+  if (!isVoxActive || (playing_state != recording)) return;
+  if (!isCalling || (isArmed ? isTriggered : isVoxClosing)) {
+    isVoxPending = false;
+    return;
+  }
+  if (!isVoxPending) {
+    isVoxPending = true;
+    voxSince = now;
+  }
+  if (now - voxSince >= (isArmed ? voxAttack : voxHang)) {
+    isVoxPending = false;
+    if (isArmed) {
+      isTriggered = true;
+    } else {
+      isVoxClosing = true;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Set voice activated recording
+ *
+ * \param[in] startLevel recording level opening the gate, zero to disable.
+ * \param[in] stopLevel recording level below which the gate closes, lower
+ * than startLevel for hysteresis.
+ * \param[in] attack milliseconds the level must stay up to open the gate.
+ * \param[in] hang milliseconds the level must stay down to close the gate.
+ *
+ * Applies to the next recordOgg() or recordWav(). While the gate is closed
+ * the recording is armed, its data going to the ring set by setPreTrigger()
+ * for the onset to be kept, or discarded. The gate opens and closes at Ogg
+ * page or ADPCM block boundaries, so the silent stretches are simply left
+ * out of the file. The recording level is then read every VOX_LEVEL_PERIOD.
+ *
+ * Without a ring, the gate starts open. With one, it starts closed.
+ *
+ * \note WAV recordings take the level from their samples, hence only PCM
+ * ones are voice activated.
+ */
+void vs1053::setVoiceActivation(uint16_t startLevel, uint16_t stopLevel, uint16_t attack, uint16_t hang) {
+  voxStartLevel = startLevel;
+  voxStopLevel = stopLevel;
+  voxAttack = attack;
+  voxHang = hang;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Emit recorded data to the stream and the file
+ *
+ * \param[in] buf recorded data.
+ * \param[in] size number of bytes.
+ *
+ * Queues the data for the stream, unless the queue is full. Then the data is
+ * dropped up to the next page or block boundary, for the stream to remain
+ * decodable, and counted as streamDropped.
+ *
+ * \return true when the data was written to the file, or there is none.
+ */
+bool vs1053::emitRecorded(const uint8_t* buf, uint16_t size) {
+  recordEmitted += size;
+  if (recordStream && (isStreamDropping || (size > streamQueueSize - streamQueued))) {
+    isStreamDropping = true;
+    recordStats.streamDropped += size;
+  } else if (recordStream) {
+    uint16_t left = size;
+    const uint8_t* p = buf;
+    while (left) {
+      uint16_t at = (streamHead + streamQueued) % streamQueueSize;
+      uint16_t n = streamQueueSize - at;
+      if (n > left) n = left;
+      memcpy(&streamQueue[at], p, n);
+      streamQueued += n;
+      p += n;
+      left -= n;
+    }
+  }
+  return !isRecordingFile || writeRecorded(buf, size);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Send the queued data to the recording stream
+ *
+ * \param[in] isBlocking wait for the stream to take all of it, else only
+ * send what its availableForWrite() tells it takes without waiting, or
+ * STREAM_FALLBACK_WRITE bytes when it tells none.
+ */
+void vs1053::drainStream(bool isBlocking) {
+  bool isFallback = false;
+
+  while (streamQueued && !isFallback) {
+    uint16_t n = streamQueueSize - streamHead;
+    if (n > streamQueued) n = streamQueued;
+    if (!isBlocking) {
+      int room = recordStream->availableForWrite();
+      if (room <= 0) {
+        /* Stream::availableForWrite() returns 0 unless overridden */
+        if (!STREAM_FALLBACK_WRITE) break;
+        room = STREAM_FALLBACK_WRITE;
+        isFallback = true;
       }
-      break;
+      if (n > (uint16_t)room) n = room;
+    }
+    n = recordStream->write(&streamQueue[streamHead], n);
+    if (!n) break;
+    streamHead = (streamHead + n) % streamQueueSize;
+    streamQueued -= n;
+    recordStats.streamBytes += n;
   }
-  
-  if (finished) {
-    disableRefill(true);
-    track.close(); // Close out this track
-    
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Set a stream to send recordings to
+ *
+ * \param[in] stream e.g. Serial or an EthernetClient, NULL for none.
+ * \param[in] queue buffer, to be kept for as long as recordings use it.
+ * \param[in] size of the queue in bytes.
+ *
+ * Applies to the next recordOgg() or recordWav(), which then send their data
+ * to the stream as well as to their file, or only to the stream when given
+ * no file name. Each drain queues the data, then sends what the stream
+ * takes without waiting, as told by its availableForWrite(). So a slow
+ * stream never holds up the recording. It loses whole pages or blocks once
+ * the queue is full, as counted in the recording statistics.
+ *
+ * \note Streams are expected to implement availableForWrite(), as Serial and
+ * most network clients do. Those telling no room, as Stream's own does, are
+ * sent STREAM_FALLBACK_WRITE bytes per drain, waiting for them.
+ *
+ * A streamed WAV header has its sizes left at zero, as for live streams.
+ * Neither rotation, nor the patching of headers, affect the stream.
+ */
+void vs1053::setRecordingStream(Stream* stream, uint8_t* queue, uint16_t size) {
+  recordStream = (queue && size) ? stream : NULL;
+  streamQueue = queue;
+  streamQueueSize = size;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Keep the encoder loaded between recordings
+ *
+ * \param[in] isKept true to keep the encoder, false to release it.
+ *
+ * When kept, a finished recordOgg() leaves the VSdsp as configured for
+ * encoding, its profile loaded. The next recordOgg() with the same profile
+ * then only restarts the encoder, neither resetting the VSdsp, nor changing
+ * its clock, nor loading the profile. Playing or recordWav() release it.
+ */
+void vs1053::keepEncoder(bool isKept) {
+  isEncoderKept = isKept;
+  if (!isKept && isEncoderLoaded && !isBusy()) releaseEncoder();
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Restore the VSdsp as it was before recording
+ *
+ * Restores the registers backed up when recording started, with a soft
+ * reset out of the encoder. The playback patch is then to be loaded again.
+ */
+void vs1053::releaseEncoder() {
+  if (registers_backup[0] != 0xC000) {
     Mp3WriteRegister(SCI_CLOCKF, registers_backup[0]); // Restore multiplier
     delay(1);
-    Mp3WriteRegister(SCI_BASS, registers_backup[1]); // Restore bass
-    Mp3WriteRegister(SCI_MODE, ((Mp3ReadRegister(SCI_MODE) & ~SM_ADPCM) | SM_RESET)); // Soft reset
-    delay(1);
-    isPatched = false;
-    Mp3WriteRegister(SCI_MODE, registers_backup[2]); // Restore mode
-    
-    playing_state = ready;
-    Serial.println(F("recording done"));
   }
-  
-  // Serial.print("written: "); Serial.println(written);
-#if DEBUG
-  if(position2 != position) {
-    Serial.print(F("position ")); Serial.println(position);
-    Serial.print(F("recordingLevel ")); Serial.println(recordingLevel);
-    Serial.print(F("cntIsr ")); Serial.println(cntIsr);
-    Serial.print(F("cntWork ")); Serial.println(cntWork);
-    Serial.print(F("rate ")); Serial.println(1.0 * cntWork / cntIsr * 100);
-    cntIsr = 0;
-    cntWork = 0;
+  Mp3WriteRegister(SCI_BASS, registers_backup[1]); // Restore bass
+  Mp3WriteRegister(SCI_MODE, ((Mp3ReadRegister(SCI_MODE) & ~SM_ADPCM) | SM_RESET)); // Soft reset
+  delay(1);
+  isPatched = false;
+  Mp3WriteRegister(SCI_MODE, registers_backup[2]); // Restore mode
+  isEncoderLoaded = false;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Measure the time a recording took to start
+ *
+ * \param[in] startedAt micros() when it was asked to start.
+ *
+ * Kept as startLatency in the recording statistics, with a warning beyond
+ * RECORD_START_BUDGET.
+ */
+void vs1053::checkStartLatency(uint32_t startedAt) {
+  recordStats.startLatency = micros() - startedAt;
+  if (recordStats.startLatency > RECORD_START_BUDGET) {
+    Serial.print(F("Warning: recording started in ")); Serial.print(recordStats.startLatency); Serial.println(F(" us"));
   }
-#endif
-  return result;
 }
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Set when recordings switch to a new file
+ *
+ * \param[in] minutes length of each file, zero for no limit.
+ * \param[in] megabytes (optional) size of each file, zero for no limit.
+ *
+ * Applies to the next recordOgg() or recordWav(). The encoder is not stopped,
+ * the data keeps being drained into the new file while the old one is closed.
+ * Each file is playable on its own, the next Ogg ones starting with a gap in
+ * page sequence numbers and a granule position other than zero.
+ */
+void vs1053::setRecordingRotation(uint16_t minutes, uint16_t megabytes) {
+  rotateMsec = minutes * 60000UL;
+  rotateBytes = megabytes * 1048576UL;
+}
+
+//------------------------------------------------------------------------------
 /**
  * \brief Gracefully stop recording
  *
@@ -1428,6 +3197,7 @@ uint8_t vs1053::oggRefill() {
 void vs1053::stopRecord(){
   if (isBusy() != 0x02) return;
 
+  isTriggered = true; // an armed recording keeps its ring
   playing_state = finishing;
   Serial.println(F("Recording is finishing!"));
 }
@@ -1460,6 +3230,7 @@ uint8_t vs1053::isBusy(){
         break;
       case cancelling:
       case skipping:
+      case resyncing:
         result = 0x03;
         break;
       case finishing:
@@ -1521,7 +3292,10 @@ uint8_t vs1053::resumeMusic(uint32_t timecode) {
   if ((playing_state != paused_playback) || !digitalRead(MP3_RESET)) return 1;
 
   if (timecode != 0xFFFFFFFF) {
-    if (!track.seekSet(timecode * Mp3ReadWRAM(para_byteRate) / 1000 + start_of_music)) return 2;
+    if ((meta.format == wav) && meta.byteRate) {
+      uint32_t offset = (timecode / 1000) * meta.byteRate + (timecode % 1000) * meta.byteRate / 1000;
+      if (jumpTo(meta.start + offset - (offset % meta.blockAlign), timecode / 1000)) return 2;
+    } else if (!track.seekSet(timecode * Mp3ReadWRAM(para_byteRate) / 1000 + meta.start)) return 2;
   }
 
   enableRefill();
@@ -1549,16 +3323,16 @@ uint8_t vs1053::skip(int32_t seconds) {
   if ((isBusy() != 0x01) || seconds == 0) return 1;
   
   uint32_t targetPosition;
-  if (trackFormat == ogg) {
+  if ((meta.format == ogg) || isSeekable()) {
     if ((seconds < 0) && ((uint32_t)(-seconds) > position)) {
       targetPosition = 0;
-    } else if ((position + seconds) > duration) {
-      targetPosition = duration;
+    } else if ((position + seconds) > meta.duration) {
+      targetPosition = meta.duration;
     } else {
       targetPosition = position + seconds;
     }
   } else {
-    targetPosition = (track.curPosition() - start_of_music) / Mp3ReadWRAM(para_byteRate) + seconds;
+    targetPosition = (track.curPosition() - meta.start) / Mp3ReadWRAM(para_byteRate) + seconds;
   }
   return skipTo(targetPosition);
 }
@@ -1571,6 +3345,16 @@ uint8_t vs1053::skip(int32_t seconds) {
  *
  * Repositions the filehandles track location to the requested offset.
  * As calculated by the bitrate multiplied by the desired ms offset.
+ * WAV files with a parsed "fmt " chunk are positioned directly on a block
+ * aligned offset from their exact byte rate, MP4/M4A files on the latest
+ * chunk of their seek table and WMA files on a data packet, from their Simple
+ * Index when present.
+ *
+ * MP3 files are jumped to a frame header, found by scanning from the offset
+ * estimated from the VSdsp's byte rate, and confirmed by the header of the
+ * following frame. The jump itself is processed by refill(), which fades the
+ * volume out, jumps, lets the VSdsp resync muted and fades it back in, so
+ * this returns without waiting.
  *
  * \return
  * - 0 indicates the position was changed.
@@ -1582,10 +3366,10 @@ uint8_t vs1053::skip(int32_t seconds) {
 uint8_t vs1053::skipTo(uint32_t seconds) {
   if (isBusy() != 0x01) return 1;
   
-  if (trackFormat == ogg) {
+  if (meta.format == ogg) {
     bool isPaused = playing_state == paused_playback;
-    if (seconds >= duration) {
-      skipToPosition = duration;
+    if (seconds >= meta.duration) {
+      skipToPosition = meta.duration;
       playing_state = cancelling;
     } else {
       skipToPosition = seconds;
@@ -1593,6 +3377,64 @@ uint8_t vs1053::skipTo(uint32_t seconds) {
     }
     Serial.print(F("skipping to ")); Serial.println(skipToPosition);
     if (isPaused) enableRefill(); // Skipping is processed by refill()
+  } else if (isSeekable()) {
+    if (meta.duration && (seconds >= meta.duration)) {
+      bool isPaused = playing_state == paused_playback;
+      playing_state = cancelling;
+      if (isPaused) enableRefill(); // Stopping is processed by refill()
+      return 0;
+    }
+    if (meta.format == wav) {
+      // PCM and ADPCM carry no decoder state between blocks, so jump straight
+      // to the block aligned offset, without cancelling or fast-forwarding.
+      uint32_t offset = seconds * meta.byteRate;
+      return jumpTo(meta.start + offset - (offset % meta.blockAlign), seconds);
+    } else if (meta.format == wma) {
+      // ASF is decodable from any data packet, prefer the Simple Index's packet.
+      uint8_t temp[4];
+      uint32_t packet = meta.duration ? (uint32_t)((uint64_t)seconds * meta.packetCount / meta.duration) : 0;
+      uint16_t packetSeconds = seconds;
+      if (meta.indexCount && meta.indexInterval) {
+        uint32_t entry = seconds * 1000UL / meta.indexInterval;
+        if (entry >= meta.indexCount) entry = meta.indexCount - 1;
+        disableRefill(); // the index is read through the track's filehandle
+        if (track.seekSet(meta.indexOffset + entry * 6) && (track.read(temp, 4) == 4)) {
+          packet = le32(temp);
+          packetSeconds = entry * meta.indexInterval / 1000;
+        }
+      }
+      if (packet >= meta.packetCount) packet = meta.packetCount - 1;
+      return jumpTo(meta.start + packet * meta.blockAlign, packetSeconds);
+    }
+    // Otherwise resume at the latest seek point, not after the requested time.
+    uint8_t i = meta.seekPoints - 1;
+    while (i && (seekTable[i].seconds > seconds)) i--;
+    return jumpTo(seekTable[i].offset, seekTable[i].seconds);
+  } else if (meta.format == mp3) {
+    // Jump to a frame header near the byte rate estimate, and let the VSdsp
+    // resync there, while refill() ramps the volume down and back up.
+    uint32_t offset = seconds * Mp3ReadWRAM(para_byteRate) + meta.start;
+    bool isPaused = playing_state == paused_playback;
+    bool isHeld = holdRefill();
+    uint8_t* buf = borrowBuffer();
+    uint32_t resume = track.curPosition();
+    bool isFound = findMp3Frame(track, &offset, buf);
+    track.seekSet(resume);
+    releaseRefill(isHeld);
+    if (!isFound) return 2;
+
+    if (!isResyncSet) seekResync = Mp3ReadWRAM(para_resync);
+    Mp3WriteWRAM(para_resync, 32767);
+    isResyncSet = true;
+#if DEBUG
+    seekStarted = millis();
+#endif
+    seekOffset = offset;
+    skipToPosition = seconds;
+    seekStep = 0;
+    playing_state = resyncing;
+    Serial.print(F("resyncing to ")); Serial.println(skipToPosition);
+    if (isPaused) enableRefill(); // Resyncing is processed by refill()
   } else {
     //stop interupt for now
     disableRefill();
@@ -1600,7 +3442,7 @@ uint8_t vs1053::skipTo(uint32_t seconds) {
 
     // try to set the files position to current position + offset(in bytes)
     // as calculated from current byte rate, as per VSdsp.
-    if(!track.seekSet(seconds * Mp3ReadWRAM(para_byteRate) + start_of_music)) return 2; // skip to X ms.
+    if(!track.seekSet(seconds * Mp3ReadWRAM(para_byteRate) + meta.start)) return 2; // skip to X ms.
 
     Mp3WriteRegister(SCI_VOL, 0xFE, 0xFE);
     //seeked successfully
@@ -1629,6 +3471,155 @@ uint8_t vs1053::skipTo(uint32_t seconds) {
   return 0;
 }
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Indicate if the current track can be jumped to exact offsets
+ *
+ * \return true when the container of the current track provided what is needed
+ * to locate decodable file offsets, as used by skipTo() and jumpTo().
+ */
+bool vs1053::isSeekable() {
+  return ((meta.format == wav) && meta.byteRate) || ((meta.format == wma) && meta.packetCount) || meta.seekPoints;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Find a MP3 frame header
+ *
+ * \param[in] file open file handle of the track.
+ * \param[in,out] offset file offset to scan from, updated with the offset of
+ * the frame found.
+ * \param[in] buf scratch buffer of BUFFER_SIZE bytes.
+ *
+ * A header is only accepted when followed, one frame length later, by the
+ * header of a frame of the same version, layer and sample rate. So sync
+ * patterns within the audio data are skipped.
+ *
+ * \return true when a frame was found within MP3_SYNC_SCAN_LIMIT bytes.
+ */
+bool vs1053::findMp3Frame(SdFile& file, uint32_t* offset, uint8_t* buf) {
+  uint32_t at = *offset;
+  uint32_t scanned = 0;
+  uint8_t next[4];
+  int16_t len;
+
+  while ((scanned < MP3_SYNC_SCAN_LIMIT) && file.seekSet(at) && ((len = file.read(buf, BUFFER_SIZE)) >= 4)) {
+    for (int16_t i = 0; i <= len - 4; i++) {
+      uint16_t frame = mp3FrameLength(&buf[i]);
+      if (!frame) continue;
+      if (file.seekSet(at + i + frame) && (file.read(next, 4) == 4) && mp3FrameLength(next) && \
+          ((next[1] & 0xFE) == (buf[i + 1] & 0xFE)) && ((next[2] & 0x0C) == (buf[i + 2] & 0x0C))) {
+        *offset = at + i;
+        return true;
+      }
+    }
+    /* Keep the last three bytes, a header may straddle the buffers */
+    at += len - 3;
+    scanned += len - 3;
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Process a MP3 seek, one 32-byte chunk at a time
+ *
+ * Called by refill() before feeding each chunk while resyncing:
+ * 1. Fades the volume out over SEEK_RAMP_STEPS chunks
+ * 2. Jumps the track to the frame found by skipTo()
+ * 3. Feeds muted the 2048 bytes of the VSdsp's FIFO, still holding data from
+ *    before the jump, then SEEK_MUTE_CHUNKS chunks while the VSdsp resyncs
+ * 4. Fades the volume back in over SEEK_RAMP_STEPS chunks, then restores
+ *    para_resync
+ *
+ * \return true when the track was jumped, so the buffered data is discarded.
+ */
+bool vs1053::resyncStep() {
+  uint8_t ramp;
+
+  if (seekStep < SEEK_RAMP_STEPS) {
+    ramp = seekStep + 1;
+  } else if (seekStep == SEEK_RAMP_STEPS) {
+    if (track.seekSet(seekOffset)) {
+      bufferOffset = sizeof(mp3DataBuffer); // discard data read from prior position
+      sciWrite(SCI_DECODE_TIME, skipToPosition);
+      sciWrite(SCI_DECODE_TIME, skipToPosition);
+      position = skipToPosition;
+      positionMsec = (uint32_t)skipToPosition * 1000;
+      positionMsecAt = millis();
+    }
+    seekStep++;
+    return true;
+  } else if (seekStep <= SEEK_RAMP_STEPS + SEEK_FIFO_CHUNKS + SEEK_MUTE_CHUNKS) {
+    ramp = SEEK_RAMP_STEPS;
+  } else if (seekStep < 2 * SEEK_RAMP_STEPS + SEEK_FIFO_CHUNKS + SEEK_MUTE_CHUNKS) {
+    ramp = 2 * SEEK_RAMP_STEPS + SEEK_FIFO_CHUNKS + SEEK_MUTE_CHUNKS - seekStep;
+  } else {
+    sciWrite(SCI_VOL, ((uint16_t)VolL << 8) | VolR); // Restore
+    sciWrite(SCI_WRAMADDR, para_resync);
+    sciWrite(SCI_WRAM, seekResync);
+    isResyncSet = false;
+    playing_state = playback;
+#if DEBUG
+    Serial.print(F("resync ms ")); Serial.println(millis() - seekStarted);
+#endif
+    return false;
+  }
+  sciWrite(SCI_VOL, ((uint16_t)(VolL + (0xFE - VolL) * ramp / SEEK_RAMP_STEPS) << 8) | \
+                    (VolR + (0xFE - VolR) * ramp / SEEK_RAMP_STEPS));
+  seekStep++;
+  return false;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Jump the current track to a decodable file offset
+ *
+ * \param[in] offset file offset to resume streaming from.
+ * \param[in] seconds playing time corresponding to the offset.
+ *
+ * Repositions the filehandle directly, discarding the buffered data, and
+ * updates the decode time. Used for formats whose offsets are known exactly,
+ * so no cancel nor fast-forward of the decoder is needed.
+ *
+ * \return
+ * - 0 indicates the position was changed.
+ * - 2 indicates failure to skip to new file location.
+ */
+uint8_t vs1053::jumpTo(uint32_t offset, uint16_t seconds) {
+  bool isPaused = playing_state == paused_playback;
+  disableRefill();
+  playing_state = paused_playback;
+
+  if ((meta.format == wav) && (meta.blockAlign > 1)) {
+    /* Keep the phase of the block being decoded, as the VSdsp does not
+    resync within the data chunk */
+    uint32_t fed = track.curPosition() - (sizeof(mp3DataBuffer) - bufferOffset);
+    if (fed > meta.start) offset += (fed - meta.start) % meta.blockAlign;
+  }
+  if (!track.seekSet(offset)) {
+    if (!isPaused) {
+      playing_state = playback;
+      enableRefill();
+    }
+    return 2;
+  }
+  bufferOffset = sizeof(mp3DataBuffer); // discard data read from prior position
+  position = seconds;
+  positionMsec = (uint32_t)seconds * 1000;
+  positionMsecAt = millis();
+
+  Mp3WriteRegister(SCI_DECODE_TIME, seconds);
+  Mp3WriteRegister(SCI_DECODE_TIME, seconds);
+
+  if (!isPaused) {
+    playing_state = playback;
+    refill();
+    enableRefill();
+  }
+  return 0;
+}
+
 //------------------------------------------------------------------------------
 /**
  * \brief Current timecode in ms
@@ -1648,6 +3639,32 @@ uint32_t vs1053::currentPosition(){
   return position;
 }
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Current timecode in ms, to the millisecond
+ *
+ * Takes the VSdsp's positionMsec, as last sampled by refill(), and adds the
+ * time elapsed since while playing. Only a copy of the sample is read, the
+ * VSdsp is not accessed.
+ *
+ * \return the milliseconds offset of stream played.
+ *
+ * \note Codecs not providing positionMsec fall back on the decode time,
+ * taken when its second changes. That is only accurate to
+ * POSITION_SAMPLE_PERIOD.
+ */
+uint32_t vs1053::currentPositionMsec() {
+  uint32_t msec;
+  uint32_t at;
+
+  noInterrupts(); // sampled by refill(), possibly in an interrupt
+  msec = positionMsec;
+  at = positionMsecAt;
+  interrupts();
+  if (playing_state == playback) msec += millis() - at;
+  return msec;
+}
+
 // @}
 // Play_Control_Group
 
@@ -1661,14 +3678,17 @@ uint32_t vs1053::currentPosition(){
  *
  * \param[out] infobuffer pointer char array to be updated with result
  *
- * Extract the Artist from the current filehandles track ID3 tag information.
+ * Copy the Artist of the current track, from its ID3 tag information as cached
+ * when the track was opened.
+ *
+ * \note infobuffer must hold at least TRACK_TAG_LENGTH characters.
  *
  * \warning ID3 Tag information may not be present on all source files.
- * Otherwise may result in non-sense.
+ * Otherwise results in an empty string.
  * It is possible to add it with common tools outside of this project.
  */
 void vs1053::trackArtist(char* infobuffer){
-  getTrackInfo(TRACK_ARTIST, infobuffer);
+  strcpy(infobuffer, tag.artist);
 }
 
 //------------------------------------------------------------------------------
@@ -1677,14 +3697,17 @@ void vs1053::trackArtist(char* infobuffer){
  *
  * \param[out] infobuffer pointer char array to be updated with result
  *
- * Extract the Title from the current filehandles track ID3 tag information.
+ * Copy the Title of the current track, from its ID3 tag information as cached
+ * when the track was opened.
+ *
+ * \note infobuffer must hold at least TRACK_TAG_LENGTH characters.
  *
  * \warning ID3 Tag information may not be present on all source files.
- * Otherwise may result in non-sense.
+ * Otherwise results in an empty string.
  * It is possible to add it with common tools outside of this project.
  */
 void vs1053::trackTitle(char* infobuffer){
-  getTrackInfo(TRACK_TITLE, infobuffer);
+  strcpy(infobuffer, tag.title);
 }
 
 //------------------------------------------------------------------------------
@@ -1693,54 +3716,215 @@ void vs1053::trackTitle(char* infobuffer){
  *
  * \param[out] infobuffer pointer char array to be updated with result
  *
- * Extract the Album from the current filehandles track ID3 tag information.
+ * Copy the Album of the current track, from its ID3 tag information as cached
+ * when the track was opened.
+ *
+ * \note infobuffer must hold at least TRACK_TAG_LENGTH characters.
  *
  * \warning ID3 Tag information may not be present on all source files.
- * Otherwise may result in non-sense.
+ * Otherwise results in an empty string.
  * It is possible to add it with common tools outside of this project.
  */
 void vs1053::trackAlbum(char* infobuffer){
-  getTrackInfo(TRACK_ALBUM, infobuffer);
+  strcpy(infobuffer, tag.album);
 }
 
 //------------------------------------------------------------------------------
 /**
- * \brief Fetch ID3 Tag information
+ * \brief Get Track's Number
+ *
+ * Extract the track number from the current track's ID3v2 tag information, or
+ * Vorbis comments, as cached when the track was opened.
+ *
+ * \return the number of the track in its album, zero when unknown.
+ */
+uint8_t vs1053::trackNumber(){
+  return tag.number;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Get Track's ReplayGain
  *
- * \param[in] offset for the desired information desired.
- * \param[out] infobuffer pointer char array of filename to be read.
+ * \param[in] isAlbum true to get the album gain instead of the track gain.
  *
- * Read current filehandles offset of track ID3 tag information. Then strip
- * all non readible (ascii) characters.
+ * Extract the ReplayGain from the current track's ID3v2 tag information, or
+ * Vorbis comments, as cached when the track was opened.
  *
- * \note this suspends currently playing streams and returns afterwards.
- * Restoring the file position to where it left off, before resuming.
+ * \return the gain to be applied in hundredths of a dB, zero when unknown.
  */
-void vs1053::getTrackInfo(uint8_t offset, char* infobuffer){
+int16_t vs1053::trackReplayGain(bool isAlbum){
+  return isAlbum ? tag.albumGain : tag.trackGain;
+}
 
-  //disable interupts
-  if(playing_state == playback) {
-    disableRefill();
+//------------------------------------------------------------------------------
+/**
+ * \brief Fetch ID3v2 Tag information
+ *
+ * \param[in] file open file handle of the track.
+ * \param[out] info tag information to be updated.
+ * \param[out] meta stream layout, whose duration is updated from TLEN.
+ * \param[in] buf scratch buffer of BUFFER_SIZE bytes, holding the first bytes
+ * of the file.
+ *
+ * Walk the frames of an ID3v2.2, v2.3 or v2.4 tag in a single forward pass,
+ * through buf. The text of the title (TIT2), artist (TPE1), album (TALB),
+ * track number (TRCK), length (TLEN) and ReplayGain (TXXX) frames is folded
+ * to ASCII into the fixed size fields of info, other frames are skipped.
+ *
+ * Ref: https://id3.org/id3v2.4.0-structure
+ *
+ * \return the file offset following the tag, zero when there is no tag.
+ *
+ * \note Compressed and encrypted frames are skipped.
+ */
+uint32_t vs1053::getID3v2Tag(SdFile& file, track_tag_m* info, track_meta_m* meta, uint8_t* buf) {
+  tag_reader_m r;
+  uint8_t head[10];
+  uint8_t version = buf[3];
+  uint8_t flags = buf[5];
+  uint8_t footer = ((version == 4) && (flags & 0x10)) ? 10 : 0;
+  uint32_t tagEnd;
+
+  if (memcmp(buf, "ID3", 3)) return 0;
+  /* Syncsafe tag size, excluding the header and an optional footer */
+  tagEnd = ((uint32_t)(buf[6] & 0x7F)) << 21 | \
+           ((uint32_t)(buf[7] & 0x7F)) << 14 | \
+           ((uint32_t)(buf[8] & 0x7F)) << 7 | \
+           ((uint32_t)(buf[9] & 0x7F));
+  tagEnd += 10;
+  if (!info || (version < 2) || (version > 4)) {
+    return tagEnd + footer;
   }
 
-  //record current file position
-  uint32_t currentPos = track.curPosition();
+  r.file = &file;
+  r.buf = buf;
+  r.len = r.offset = 0;
+  r.pos = 10;
+  r.limit = tagEnd;
+  r.isFF = false;
+  r.isOgg = false;
+  /* v2.4 flags the unsynchronisation of each frame instead */
+  r.isUnsync = (flags & 0x80) && (version < 4);
+  file.seekSet(10);
+
+  if ((flags & 0x40) && (version > 2)) {
+    /* Extended header, its size excludes itself in v2.3 only */
+    uint32_t size = 0;
+    r.count = 4;
+    for (uint8_t i = 0; i < 4; i++) size = (size << ((version == 4) ? 7 : 8)) | (r.next() & ((version == 4) ? 0x7F : 0xFF));
+    r.count = (version == 4) ? size - 4 : size;
+    r.skip();
+  }
 
-  //skip to end
-  track.seekEnd((-128 + offset));
+  while (r.pos + ((version == 2) ? 6 : 10) <= tagEnd) {
+    uint8_t headLen = (version == 2) ? 6 : 10;
+    uint32_t size;
+    uint8_t frameFlags = 0;
+    bool isReadable = true;
+
+    r.limit = tagEnd;
+    r.count = headLen;
+    r.isUnsync = (flags & 0x80) && (version < 4);
+    for (uint8_t i = 0; i < headLen; i++) {
+      int16_t c = r.next();
+      if (c < 0) {
+        head[0] = 0; // truncated
+        break;
+      }
+      head[i] = c;
+    }
+    if (!head[0]) break; // padding
 
-  //read 30 bytes of tag informat at -128 + offset
-  track.read(infobuffer, 30);
-  infobuffer = strip_nonalpha_inplace(infobuffer);
+    if (version == 2) {
+      size = ((uint32_t)head[3]) << 16 | ((uint32_t)head[4]) << 8 | head[5];
+    } else if (version == 3) {
+      size = ((uint32_t)head[4]) << 24 | ((uint32_t)head[5]) << 16 | ((uint32_t)head[6]) << 8 | head[7];
+      frameFlags = head[9];
+    } else {
+      size = ((uint32_t)(head[4] & 0x7F)) << 21 | ((uint32_t)(head[5] & 0x7F)) << 14 | \
+             ((uint32_t)(head[6] & 0x7F)) << 7 | (head[7] & 0x7F);
+      frameFlags = head[9];
+    }
 
-  //seek back to saved file position
-  track.seekSet(currentPos);
+    if (version == 4) {
+      /* Measured on the file, after unsynchronisation */
+      if (size < tagEnd - r.pos) r.limit = r.pos + size;
+      r.count = 0xFFFFFFFFUL;
+      r.isUnsync = (frameFlags & 0x02) || (flags & 0x80);
+      if (frameFlags & 0x0C) isReadable = false; // compressed or encrypted
+      if (frameFlags & 0x40) r.next();           // group identifier
+      if (frameFlags & 0x01) for (uint8_t i = 0; i < 4; i++) r.next(); // data length
+    } else {
+      r.count = size;
+      if (frameFlags & 0xC0) isReadable = false; // compressed or encrypted
+      if (frameFlags & 0x20) r.next();           // group identifier
+    }
 
-  //renable interupt
-  if(playing_state == playback) {
-    enableRefill();
+    if (isReadable) {
+      char* dest = NULL;
+      char value[12];
+      if (isId3Frame(head, version, "TIT2", "TT2")) dest = info->title;
+      else if (isId3Frame(head, version, "TPE1", "TP1")) dest = info->artist;
+      else if (isId3Frame(head, version, "TALB", "TAL")) dest = info->album;
+
+      if (dest) {
+        readTagString(&r, r.next(), dest, TRACK_TAG_LENGTH);
+      } else if (isId3Frame(head, version, "TRCK", "TRK")) {
+        readTagString(&r, r.next(), value, sizeof(value));
+        int16_t number = atoi(value); // "3/12" reads as 3
+        info->number = ((number > 0) && (number < 256)) ? number : 0;
+      } else if (isId3Frame(head, version, "TLEN", "TLE")) {
+        readTagString(&r, r.next(), value, sizeof(value));
+        meta->duration = (uint16_t)(atol(value) / 1000);
+      } else if (isId3Frame(head, version, "TXXX", "TXX")) {
+        char description[24];
+        uint8_t encoding = r.next();
+        readTagString(&r, encoding, description, sizeof(description));
+        readTagString(&r, encoding, value, sizeof(value));
+        if (!strcasecmp_P(description, PSTR("REPLAYGAIN_TRACK_GAIN"))) {
+          info->trackGain = parseGain(value);
+        } else if (!strcasecmp_P(description, PSTR("REPLAYGAIN_ALBUM_GAIN"))) {
+          info->albumGain = parseGain(value);
+        }
+      }
+    }
+    r.skip();
   }
+  return tagEnd + footer;
+}
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Fetch ID3 Tag information
+ *
+ * \param[in] file open file handle of the track.
+ * \param[out] info tag information to be updated.
+ * \param[in] buf scratch buffer of BUFFER_SIZE bytes.
+ *
+ * Read the 128 bytes ID3v1 tag at the end of the file at once. Then strip all
+ * non readible (ascii) characters from the end of each field.
+ *
+ * \note Only fields still empty are updated, so ID3v2 information prevails.
+ */
+#if BUFFER_SIZE < 128
+  #error "BUFFER_SIZE must hold the 128 bytes of an ID3v1 tag"
+#endif
+void vs1053::getID3v1Tag(SdFile& file, track_tag_m* info, uint8_t* buf){
+  const uint8_t offsets[] = {TRACK_TITLE, TRACK_ARTIST, TRACK_ALBUM};
+  char* fields[] = {info->title, info->artist, info->album};
+
+  //read the whole tag at -128
+  if ((file.fileSize() < 128) || !file.seekEnd(-128)) return;
+  if ((file.read(buf, 128) != 128) || memcmp(buf, "TAG", 3)) return;
+
+  for (uint8_t i = 0; i < sizeof(offsets); i++) {
+    if (fields[i][0]) continue;
+    memcpy(fields[i], &buf[offsets[i]], TRACK_TAG_LENGTH - 1);
+    fields[i][TRACK_TAG_LENGTH - 1] = '\0';
+    char* text = strip_nonalpha_inplace(fields[i]);
+    memmove(fields[i], text, strlen(text) + 1);
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -1748,7 +3932,7 @@ void vs1053::getTrackInfo(uint8_t offset, char* infobuffer){
  * \brief Playable duration in second
  */
 uint32_t vs1053::getDuration(){
-  return duration;
+  return meta.duration;
 }
 
 //------------------------------------------------------------------------------
@@ -1830,153 +4014,261 @@ void vs1053::getAudioInfo() {
   Serial.print(F("\t\t"));
   Serial.print(currentPosition(), DEC);
 
-  Serial.println();
+  Serial.println();
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Probe a track for its format and stream layout
+ *
+ * \param[in] file open file handle of the track.
+ * \param[out] meta stream layout of the track.
+ * \param[out] info tag information of the track, or NULL.
+ * \param[in] buf scratch buffer of BUFFER_SIZE bytes.
+ * \param[out] table seek table of SEEK_TABLE_SIZE points to fill, or NULL.
+ *
+ * The first buffer of the file is read once, reading past any ID3v2 tag, and
+ * the format is sniffed from its magic bytes. The same buffer is then handed to
+ * the parser of that format. When not recognized, an MP3 frame is still looked
+ * for within MP3_SYNC_SCAN_LIMIT bytes. Tag fields not found in the ID3v2 tag
+ * are then taken from the ID3v1 tag, which also ends the audio of MP3 tracks.
+ *
+ * \return the sniffed format, unknownFormat when the content is not recognized.
+ *
+ * \note The file position is left at zero.
+ */
+format_m vs1053::probeTrack(SdFile& file, track_meta_m* meta, track_tag_m* info, uint8_t* buf, seek_point_m* table) {
+  uint32_t tagEnd = 0;
+  int16_t len;
+
+  memset(meta, 0, sizeof(track_meta_m));
+  meta->blockAlign = 1;
+  if (info) memset(info, 0, sizeof(track_tag_m));
+
+  file.seekSet(0);
+  len = file.read(buf, BUFFER_SIZE);
+  if ((len >= 10) && !memcmp(buf, "ID3", 3)) {
+    tagEnd = getID3v2Tag(file, info, meta, buf);
+    file.seekSet(tagEnd);
+    len = file.read(buf, BUFFER_SIZE);
+  }
+  meta->start = tagEnd;
+  meta->format = (len > 0) ? getTrackFormat(buf, len) : unknownFormat;
+
+  switch (meta->format) {
+    case mp3:
+      getBitRateFromMP3File(file, meta, buf, len, tagEnd);
+      break;
+    case ogg:
+      getOggInfo(file, meta, info, buf);
+      break;
+    case wav:
+      getWavInfo(file, meta, buf);
+      break;
+    case aac:
+      getMp4Info(file, meta, buf, table);
+      break;
+    case wma:
+      getWmaInfo(file, meta, buf);
+      break;
+    case unknownFormat:
+      /* The first frame may not follow the tag straight, scan for it */
+      if (len > 0) {
+        getBitRateFromMP3File(file, meta, buf, len, tagEnd);
+        if (meta->bitrate) meta->format = mp3;
+      }
+      break;
+    default:
+      break;
+  }
+  meta->end = file.fileSize();
+  if ((meta->format == mp3) && (meta->end >= meta->start + 128) && file.seekEnd(-128) && \
+      (file.read(buf, 3) == 3) && !memcmp(buf, "TAG", 3)) {
+    meta->end -= 128; // ID3v1 tag
+  }
+  if ((meta->format == mp3) && !meta->duration && meta->bitrate) {
+    /* Estimate, exact for constant bit-rate only */
+    meta->duration = (uint16_t)((meta->end - meta->start) / (meta->bitrate * 1000UL));
+  }
+  if (info) getID3v1Tag(file, info, buf);
+  file.seekSet(0);
+  return meta->format;
 }
 
 //------------------------------------------------------------------------------
 /**
- * \brief Read the Bit-Rate from the current track's filehandle.
+ * \brief Read the Bit-Rate from the first MP3 frame of a track.
  *
- * \param[out] fileName pointer of a char array (aka string), contianing the filename
+ * \param[in] file open file handle of the track.
+ * \param[out] meta stream layout of the track.
+ * \param[in] buf scratch buffer of BUFFER_SIZE bytes, holding the first bytes
+ * following any ID3v2 tag.
+ * \param[in] len number of valid bytes in buf.
+ * \param[in] offset file offset of the first byte in buf.
  *
- * locate the MP3 header in the current file and from there determine the
- * Bit-Rate, using bitrate_table located in flash. And return the position
- * to the prior location.
+ * locate the MP3 header, starting with the buffer already read and then the
+ * following ones, and from there determine the Bit-Rate, using bitrate_table
+ * located in flash.
  *
  * \note the bitrate will be updated, as read back from the VS10xx when needed.
  *
- * \warning This feature only works on MP3 files.
- * It will \b LOCK-UP on other file formats, looking for the MP3 header.
+ * \note The scan is bounded by MP3_SYNC_SCAN_LIMIT bytes, leaving the
+ * bitrate at zero when no frame is found.
  */
-void vs1053::getBitRateFromMP3File() {
+void vs1053::getBitRateFromMP3File(SdFile& file, track_meta_m* meta, uint8_t* buf, int16_t len, uint32_t offset) {
   //look for first MP3 frame (11 1's)
-  bitrate = 0;
+  uint32_t scanned = 0;
   uint8_t temp = 0;
-  uint8_t row_num =0;
-
-    for(uint16_t i = 0; i<65535; i++) {
-      if(track.read() == 0xFF) {
-
-        temp = track.read();
-
-        if(((temp & 0b11100000) == 0b11100000) && ((temp & 0b00000110) != 0b00000000)) {
-
-          //found the 11 1's
-          //parse version, layer and bitrate out and save bitrate
-          if(!(temp & 0b00001000)) { //!true if Version 1, !false version 2 and 2.5
-            row_num = 3;
-          }
-          else if((temp & 0b00000110) == 0b00000100) { //true if layer 2, false if layer 1 or 3
-            row_num += 1;
-          }
-          else if((temp & 0b00000110) == 0b00000010) { //true if layer 3, false if layer 2 or 1
-            row_num += 2;
-          } else {
-            continue; // Not found, need to skip the rest and continue looking.
-                      // \warning But this can lead to a dead end and file end of file.
-          }
-
-          //parse bitrate code from next byte
-          temp = track.read();
-          temp = temp>>4;
-
-          //lookup bitrate
-          bitrate = pgm_read_word_near ( &(bitrate_table[temp][row_num]) );
-
-          //convert kbps to Bytes per mS
-          bitrate /= 8;
-
-          //record file position
-          track.seekCur(-3);
-          start_of_music = track.curPosition();
-
-//          Serial.print(F("POS: "));
-//          Serial.println(start_of_music);
-
-//          Serial.print(F("Bitrate: "));
-//          Serial.println(bitrate);
+  uint8_t row_num = 0;
+
+  meta->bitrate = 0;
+  meta->start = offset;
+  while (len >= 3) {
+    for (int16_t i = 0; i < len - 2; i++) {
+      if (buf[i] != 0xFF) continue;
+      temp = buf[i + 1];
+      if (((temp & 0b11100000) != 0b11100000) || ((temp & 0b00000110) == 0b00000000)) continue;
+
+      //found the 11 1's
+      //parse version, layer and bitrate out and save bitrate
+      if(!(temp & 0b00001000)) { //!true if Version 1, !false version 2 and 2.5
+        row_num = 3;
+      }
+      else if((temp & 0b00000110) == 0b00000100) { //true if layer 2, false if layer 1 or 3
+        row_num = 1;
+      }
+      else if((temp & 0b00000110) == 0b00000010) { //true if layer 3, false if layer 2 or 1
+        row_num = 2;
+      } else {
+        continue; // Not found, need to skip the rest and continue looking.
+      }
 
-          //break out of for loop
-          break;
+      //lookup bitrate from the code in next byte
+      meta->bitrate = pgm_read_word_near ( &(bitrate_table[buf[i + 2] >> 4][row_num]) ) / 8;
 
-        }
-      }
+      //record file position
+      meta->start = offset + i;
+      return;
     }
+    /* Keep the last two bytes, a header may straddle the buffers */
+    offset += len - 2;
+    scanned += len - 2;
+    if (scanned >= MP3_SYNC_SCAN_LIMIT) break;
+    if (!file.seekSet(offset)) break;
+    len = file.read(buf, BUFFER_SIZE);
   }
+}
 
 //------------------------------------------------------------------------------
 /**
  * \brief Read info from OGG file
  *
- * 1. Looking for OGG headers 
- * 2. Get the sample numbers, sample rate
- * 3. Calculate duration
+ * 1. Read the identification header packet, for the sample rate
+ * 2. Read the comment header packet, for the tag information
+ * 3. Looking for the last OGG page, for the sample numbers
+ * 4. Calculate duration
+ *
+ * \param[in] file open file handle of the track.
+ * \param[out] meta stream layout of the track.
+ * \param[out] info tag information to be updated, or NULL.
+ * \param[in] buf scratch buffer of BUFFER_SIZE bytes.
+ *
+ * The header packets are read in a single forward pass over the pages at the
+ * start of the file. The TITLE, ARTIST, ALBUM, TRACKNUMBER and
+ * REPLAYGAIN_TRACK_GAIN/REPLAYGAIN_ALBUM_GAIN comments are folded to ASCII
+ * into info, others (such as cover art) are skipped.
  *
  * Ref: https://xiph.org/vorbis/doc/Vorbis_I_spec.html#x1-620004.2.1
+ * Ref: https://xiph.org/vorbis/doc/v-comment.html
  * Ref: https://xiph.org/ogg/doc/framing.html
  *
- * \warning This feature only works on OGG files.
+ * \warning This feature only works on OGG Vorbis files.
  */
-void vs1053::getOggInfo() {
-  char header1[7] = {0x01, 'v', 'o', 'r', 'b', 'i', 's'};
+void vs1053::getOggInfo(SdFile& file, track_meta_m* meta, track_tag_m* info, uint8_t* buf) {
   char header2[6] = {'O', 'g', 'g', 'S', 0x00, 0x04};
-  uint8_t channelNumber = 0;
+  uint8_t header[16];
+  tag_reader_m r;
   uint32_t sampleRate = 0;
   uint64_t sampleNumber = 0;
 
-  /* {0x01, 'v', 'o', 'r', 'b', 'i', 's'} */
-  track.seekSet(0);
-  while (track.read(mp3DataBuffer, sizeof(mp3DataBuffer))) {
-    int16_t offset = -1;
-    for (uint16_t i = 0; i < sizeof(mp3DataBuffer); i++) {
-      if (mp3DataBuffer[i] == 'v') {
-        bool doneForLoop = false;
-        if (i + sizeof(header1) - 1 > sizeof(mp3DataBuffer)) {
-          track.seekSet(track.curPosition() - sizeof(mp3DataBuffer) + i - 1);
-          track.read(mp3DataBuffer, 16);
-          i = 1;
-          doneForLoop = true;
-        }
-        if (!memcmp(header1, &mp3DataBuffer[i - 1], sizeof(header1))) {
-          offset = i + 10;
-          break;
-        }
-        if (doneForLoop) break;
+  r.file = &file;
+  r.buf = buf;
+  r.len = r.offset = 0;
+  r.pos = 0;
+  r.limit = file.fileSize();
+  r.pageEnd = 0;
+  r.isOgg = true;
+  r.isUnsync = false;
+  r.isFF = false;
+  file.seekSet(0);
+
+  /* {0x01, 'v', 'o', 'r', 'b', 'i', 's'}, alone on the first page */
+  r.count = sizeof(header);
+  for (uint8_t i = 0; i < sizeof(header); i++) header[i] = r.next();
+  if (memcmp_P(header, PSTR("\x01vorbis"), 7)) return;
+  sampleRate = le32(&header[12]);
+  // Serial.print("sampleRate: "); Serial.println(sampleRate);
+  if (!sampleRate) return;
+
+  /* {0x03, 'v', 'o', 'r', 'b', 'i', 's'}, starting the second page */
+  r.count = r.pageEnd - r.pos;
+  r.skip();
+  r.count = 7;
+  for (uint8_t i = 0; i < 7; i++) header[i] = r.next();
+  if (info && !memcmp_P(header, PSTR("\x03vorbis"), 7)) {
+    r.count = r.nextLe32(); // vendor
+    r.skip();
+    for (uint32_t n = r.nextLe32(); n && (r.pos < r.limit); n--) {
+      char key[24];
+      char value[12];
+      char* dest = NULL;
+      uint8_t k = 0;
+      int16_t c;
+
+      r.count = r.nextLe32();
+      while (((c = r.next()) >= 0) && (c != '=')) {
+        if (k < sizeof(key) - 1) key[k++] = c;
       }
+      key[k] = '\0';
+
+      if (!strcasecmp_P(key, PSTR("TITLE"))) dest = info->title;
+      else if (!strcasecmp_P(key, PSTR("ARTIST"))) dest = info->artist;
+      else if (!strcasecmp_P(key, PSTR("ALBUM"))) dest = info->album;
+
+      if (dest) {
+        if (!dest[0]) readTagString(&r, 3, dest, TRACK_TAG_LENGTH); // first one
+      } else if (!strcasecmp_P(key, PSTR("TRACKNUMBER"))) {
+        readTagString(&r, 3, value, sizeof(value));
+        int16_t number = atoi(value);
+        info->number = ((number > 0) && (number < 256)) ? number : 0;
+      } else if (!strcasecmp_P(key, PSTR("REPLAYGAIN_TRACK_GAIN"))) {
+        readTagString(&r, 3, value, sizeof(value));
+        info->trackGain = parseGain(value);
+      } else if (!strcasecmp_P(key, PSTR("REPLAYGAIN_ALBUM_GAIN"))) {
+        readTagString(&r, 3, value, sizeof(value));
+        info->albumGain = parseGain(value);
+      }
+      r.skip();
     }
-    if (offset < 0) continue;
-    if ((uint16_t)(offset + 4) >= sizeof(mp3DataBuffer)) {
-      track.seekSet(track.curPosition() - sizeof(mp3DataBuffer) + offset);
-      track.read(mp3DataBuffer, 5);
-      offset = 0;
-    }
-    channelNumber = mp3DataBuffer[offset];
-    sampleRate = ((uint32_t)mp3DataBuffer[offset + 4]) << 24 | \
-                 ((uint32_t)mp3DataBuffer[offset + 3]) << 16 | \
-                 ((uint32_t)mp3DataBuffer[offset + 2]) << 8 | \
-                 ((uint32_t)mp3DataBuffer[offset + 1]);
-    // Serial.print("channelNumber: "); Serial.println(channelNumber);
-    // Serial.print("sampleRate: "); Serial.println(sampleRate);
-    break;
   }
-  
+
   /* {'O', 'g', 'g', 'S', 0x00, 0x04} */
-  track.seekEnd();
-  track.seekSet(track.curPosition() - sizeof(mp3DataBuffer));
-  while(track.curPosition() >= sizeof(mp3DataBuffer)) {
+  file.seekEnd();
+  file.seekSet(file.curPosition() - BUFFER_SIZE);
+  while(file.curPosition() >= BUFFER_SIZE) {
     int16_t offset = -1;
-    uint32_t readOffset = track.curPosition();
-    track.read(mp3DataBuffer, sizeof(mp3DataBuffer));
-    for (uint16_t i = 0; i < sizeof(mp3DataBuffer); i++) {
-      if (mp3DataBuffer[i] == 'O') {
+    uint32_t readOffset = file.curPosition();
+    file.read(buf, BUFFER_SIZE);
+    for (uint16_t i = 0; i < BUFFER_SIZE; i++) {
+      if (buf[i] == 'O') {
         bool doneForLoop = false;
-        if (i + sizeof(header2) > sizeof(mp3DataBuffer)) {
-          track.seekSet(readOffset + i);
-          track.read(mp3DataBuffer, 14);
+        if (i + sizeof(header2) > BUFFER_SIZE) {
+          file.seekSet(readOffset + i);
+          file.read(buf, 14);
           i = 0;
           doneForLoop = true;
         }
-        if (!memcmp(header2, &mp3DataBuffer[i], sizeof(header2))) {
+        if (!memcmp(header2, &buf[i], sizeof(header2))) {
           offset = i + 6;
           break;
         }
@@ -1984,31 +4276,339 @@ void vs1053::getOggInfo() {
       }
     }
     if (offset < 0) {
-      track.seekSet(readOffset - sizeof(mp3DataBuffer));
+      file.seekSet(readOffset - BUFFER_SIZE);
       continue;
     }
-    if ((uint16_t)(offset + 7) >= sizeof(mp3DataBuffer)) {
-      track.seekSet(track.curPosition() - sizeof(mp3DataBuffer) + offset);
-      track.read(mp3DataBuffer, 8);
+    if ((uint16_t)(offset + 7) >= BUFFER_SIZE) {
+      file.seekSet(file.curPosition() - BUFFER_SIZE + offset);
+      file.read(buf, 8);
       offset = 0;
     }
-    sampleNumber = ((uint64_t)mp3DataBuffer[offset + 7]) << 56 | \
-                   ((uint64_t)mp3DataBuffer[offset + 6]) << 48 | \
-                   ((uint64_t)mp3DataBuffer[offset + 5]) << 40 | \
-                   ((uint64_t)mp3DataBuffer[offset + 4]) << 32 | \
-                   ((uint64_t)mp3DataBuffer[offset + 3]) << 24 | \
-                   ((uint64_t)mp3DataBuffer[offset + 2]) << 16 | \
-                   ((uint64_t)mp3DataBuffer[offset + 1]) << 8 | \
-                   ((uint64_t)mp3DataBuffer[offset + 0]);
+    sampleNumber = ((uint64_t)buf[offset + 7]) << 56 | \
+                   ((uint64_t)buf[offset + 6]) << 48 | \
+                   ((uint64_t)buf[offset + 5]) << 40 | \
+                   ((uint64_t)buf[offset + 4]) << 32 | \
+                   ((uint64_t)buf[offset + 3]) << 24 | \
+                   ((uint64_t)buf[offset + 2]) << 16 | \
+                   ((uint64_t)buf[offset + 1]) << 8 | \
+                   ((uint64_t)buf[offset + 0]);
     // Serial.print("sampleNumber: "); Serial.println((uint32_t)sampleNumber);
     break;
   }
-  duration = (uint16_t)(sampleNumber / channelNumber / sampleRate);
-  Serial.print("duration: "); Serial.println(duration);
-  track.seekSet(0);
+  /* The granule position counts samples of each channel */
+  meta->duration = (uint16_t)(sampleNumber / sampleRate);
+  // Serial.print("duration: "); Serial.println(meta->duration);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read info from WAV file
+ *
+ * 1. Check the RIFF/WAVE header
+ * 2. Walk the chunks, reading the byte rate and block alignment from "fmt "
+ * 3. Locate the "data" chunk, as the start of music
+ * 4. Calculate duration from the size of the "data" chunk
+ *
+ * \param[in] file open file handle of the track.
+ * \param[out] meta stream layout of the track.
+ * \param[in] buf scratch buffer, holding the first bytes of the file.
+ *
+ * Ref: http://soundfile.sapp.org/doc/WaveFormat/
+ *
+ * \note When no usable "fmt " chunk is found byteRate is left at zero, and
+ * skipping falls back to the byte rate reported by the VSdsp.
+ *
+ * \warning This feature only works on WAV files.
+ */
+void vs1053::getWavInfo(SdFile& file, track_meta_m* meta, uint8_t* buf) {
+  uint32_t chunkSize;
+
+  if (memcmp(buf, "RIFF", 4) || memcmp(&buf[8], "WAVE", 4)) return;
+
+  file.seekSet(12);
+  while (file.read(buf, 8) == 8) {
+    chunkSize = le32(&buf[4]);
+    if (!memcmp(buf, "fmt ", 4)) {
+      if ((chunkSize < 16) || (file.read(buf, 16) != 16)) break;
+      meta->byteRate = le32(&buf[8]);
+      meta->blockAlign = ((uint16_t)buf[13]) << 8 | buf[12];
+      if (!meta->blockAlign) meta->blockAlign = 1;
+      chunkSize -= 16;
+    } else if (!memcmp(buf, "data", 4)) {
+      meta->start = file.curPosition();
+      /* Streamed files may leave the size unset, use the rest of the file */
+      if ((chunkSize == 0) || (chunkSize > file.fileSize() - meta->start)) {
+        chunkSize = file.fileSize() - meta->start;
+      }
+      if (meta->byteRate) {
+        meta->duration = (uint16_t)(chunkSize / meta->byteRate);
+      }
+      // Serial.print("byteRate: "); Serial.println(meta->byteRate);
+      // Serial.print("start: "); Serial.println(meta->start);
+      return;
+    }
+    /* Chunks are word aligned */
+    if (!file.seekCur(chunkSize + (chunkSize & 1))) break;
+  }
+  /* No "data" chunk, not seekable */
+  meta->byteRate = 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read a big endian 32-bit word from a track
+ *
+ * \param[in] file open file handle of the track.
+ * \param[in] offset file offset of the word.
+ *
+ * \return the word read, or zero when not available.
+ */
+uint32_t vs1053::readMp4Word(SdFile& file, uint32_t offset) {
+  uint8_t temp[4];
+  if (!file.seekSet(offset) || (file.read(temp, 4) != 4)) return 0;
+  return ((uint32_t)temp[0]) << 24 | \
+         ((uint32_t)temp[1]) << 16 | \
+         ((uint32_t)temp[2]) << 8 | \
+         ((uint32_t)temp[3]);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read info from MP4/M4A (AAC) file
+ *
+ * 1. Walk the top level atoms, skipping "mdat", to find "moov" at either the
+ *    start or the end of the file
+ * 2. Get the duration from "mvhd"
+ * 3. Locate the "stts", "stsc" and "stco" (or "co64") sample tables of the
+ *    first sound track
+ * 4. Sample the chunks of that track evenly into the seek table, as pairs of
+ *    playing time and chunk offset
+ *
+ * \param[in] file open file handle of the track.
+ * \param[out] meta stream layout of the track.
+ * \param[in] buf scratch buffer, holding the first bytes of the file.
+ * \param[out] table seek table of SEEK_TABLE_SIZE points to fill, or NULL.
+ *
+ * Only the offsets and counts of the sample tables are kept while walking, and
+ * the seek table is bounded by SEEK_TABLE_SIZE, so RAM use does not depend on
+ * the length of the track.
+ *
+ * Ref: ISO/IEC 14496-12, ISO base media file format
+ *
+ * \warning This feature only works on MP4 files, raw ADTS streams are ignored.
+ */
+void vs1053::getMp4Info(SdFile& file, track_meta_m* meta, uint8_t* buf, seek_point_m* table) {
+  uint8_t* header = buf;
+  uint32_t fileSize = file.fileSize();
+  uint32_t atomStart = 0;
+  uint32_t moovEnd = 0;
+  uint32_t trakTimescale = 0;
+  uint32_t timescale = 0;
+  uint32_t sttsOffset = 0, sttsCount = 0;
+  uint32_t stscOffset = 0, stscCount = 0;
+  uint32_t stcoOffset = 0, stcoCount = 0;
+  uint8_t stcoWidth = 4;
+  bool isAudio = false;
+  bool isDone = false;
+
+  if (memcmp(&header[4], "ftyp", 4)) return;
+
+  while (atomStart + 8 <= fileSize) {
+    if (moovEnd && (atomStart >= moovEnd)) break;
+    file.seekSet(atomStart);
+    if (file.read(header, 8) != 8) break;
+    uint32_t atomSize = ((uint32_t)header[0]) << 24 | \
+                        ((uint32_t)header[1]) << 16 | \
+                        ((uint32_t)header[2]) << 8 | \
+                        ((uint32_t)header[3]);
+    uint32_t body = atomStart + 8;
+    if (atomSize == 1) {
+      /* 64-bit largesize, beyond FAT limits when its upper word is used */
+      atomSize = readMp4Word(file, body) ? 0 : readMp4Word(file, body + 4);
+      body += 8;
+    }
+    if ((atomSize == 0) || (atomSize > fileSize - atomStart)) {
+      atomSize = fileSize - atomStart; // extends to end of file
+    }
+    if (atomSize < body - atomStart) break;
+    char* type = (char*)&header[4];
+
+    if (!memcmp(type, "moov", 4)) {
+      moovEnd = atomStart + atomSize;
+      atomStart = body; // descend
+      continue;
+    }
+    if (moovEnd) {
+      if (!memcmp(type, "trak", 4)) {
+        if (stcoCount) isDone = true; // keep the first sound track only
+        isAudio = false;
+        atomStart = body;
+        continue;
+      } else if (!memcmp(type, "mdia", 4) || !memcmp(type, "minf", 4) || !memcmp(type, "stbl", 4)) {
+        atomStart = body;
+        continue;
+      } else if (!memcmp(type, "mvhd", 4) || !memcmp(type, "mdhd", 4)) {
+        bool isMovie = !memcmp(type, "mvhd", 4);
+        uint32_t scale, length;
+        if (readMp4Word(file, body) & 0xFF000000UL) {
+          /* version 1, 64-bit times */
+          scale = readMp4Word(file, body + 20);
+          length = readMp4Word(file, body + 24) ? 0xFFFFFFFFUL : readMp4Word(file, body + 28);
+        } else {
+          scale = readMp4Word(file, body + 12);
+          length = readMp4Word(file, body + 16);
+        }
+        if (!isMovie) {
+          trakTimescale = scale;
+        } else if (scale) {
+          meta->duration = (uint16_t)(length / scale);
+        }
+      } else if (!memcmp(type, "hdlr", 4)) {
+        isAudio = readMp4Word(file, body + 8) == 0x736F756EUL; // "soun"
+        if (isAudio && !isDone) timescale = trakTimescale;
+      } else if (isAudio && !isDone) {
+        if (!memcmp(type, "stts", 4)) {
+          sttsCount = readMp4Word(file, body + 4);
+          sttsOffset = body + 8;
+        } else if (!memcmp(type, "stsc", 4)) {
+          stscCount = readMp4Word(file, body + 4);
+          stscOffset = body + 8;
+        } else if (!memcmp(type, "stco", 4) || !memcmp(type, "co64", 4)) {
+          bool isWide = (type[1] == 'o');
+          stcoCount = readMp4Word(file, body + 4);
+          stcoOffset = body + 8;
+          stcoWidth = isWide ? 8 : 4;
+        }
+      }
+    }
+    atomStart += atomSize;
+  }
+
+  // Serial.print("duration: "); Serial.println(meta->duration);
+  if (table && timescale && sttsCount && stscCount && stcoCount) {
+    /* Walk the chunks, with cursors on sample-to-chunk and time-to-sample */
+    uint32_t stride = (stcoCount + SEEK_TABLE_SIZE - 1) / SEEK_TABLE_SIZE;
+    uint32_t stscIndex = 0;
+    uint32_t samplesPerChunk = readMp4Word(file, stscOffset + 4);
+    uint32_t nextFirstChunk = (stscCount > 1) ? readMp4Word(file, stscOffset + 12) : 0xFFFFFFFFUL;
+    uint32_t sttsIndex = 0;
+    uint32_t sttsRemain = readMp4Word(file, sttsOffset);
+    uint32_t sttsDelta = readMp4Word(file, sttsOffset + 4);
+    uint64_t time = 0;
+
+    for (uint32_t chunk = 1; chunk <= stcoCount; chunk++) {
+      if (chunk == nextFirstChunk) {
+        stscIndex++;
+        samplesPerChunk = readMp4Word(file, stscOffset + stscIndex * 12 + 4);
+        nextFirstChunk = (stscIndex + 1 < stscCount) ? readMp4Word(file, stscOffset + (stscIndex + 1) * 12) : 0xFFFFFFFFUL;
+      }
+      if (((chunk - 1) % stride) == 0) {
+        table[meta->seekPoints].seconds = (uint16_t)(time / timescale);
+        table[meta->seekPoints].offset = readMp4Word(file, stcoOffset + (chunk - 1) * stcoWidth + (stcoWidth - 4));
+        if (++meta->seekPoints == SEEK_TABLE_SIZE) break;
+      }
+      for (uint32_t n = samplesPerChunk; n > 0; ) {
+        if (!sttsRemain) {
+          if (++sttsIndex >= sttsCount) break;
+          sttsRemain = readMp4Word(file, sttsOffset + sttsIndex * 8);
+          sttsDelta = readMp4Word(file, sttsOffset + sttsIndex * 8 + 4);
+          continue;
+        }
+        uint32_t take = (n < sttsRemain) ? n : sttsRemain;
+        time += (uint64_t)take * sttsDelta;
+        sttsRemain -= take;
+        n -= take;
+      }
+    }
+  }
 }
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Read info from WMA (ASF) file
+ *
+ * 1. Check the ASF Header Object
+ * 2. Get the play duration, preroll, packet count and packet size from the
+ *    File Properties Object
+ * 3. Locate the first data packet after the Data Object's header, as the start
+ *    of music
+ * 4. Locate the Simple Index Object, following the Data Object, when present
+ *
+ * \param[in] file open file handle of the track.
+ * \param[out] meta stream layout of the track.
+ * \param[in] buf scratch buffer of BUFFER_SIZE bytes, holding the first bytes
+ * of the file.
+ *
+ * Ref: Advanced Systems Format (ASF) Specification, Revision 01.20.05
+ *
+ * \note Packets must be of fixed size, as required by the specification, for
+ * packet aligned seeking to be enabled.
+ *
+ * \warning This feature only works on WMA files.
+ */
+void vs1053::getWmaInfo(SdFile& file, track_meta_m* meta, uint8_t* buf) {
+  uint32_t fileSize = file.fileSize();
+  uint32_t headerSize, objectStart, objectSize;
+  uint32_t packetSize = 0;
+
+  if (memcmp_P(buf, asf_header_guid, 16)) return;
+  headerSize = le32(&buf[16]);
+
+  /* Header Object's children */
+  for (objectStart = 30; objectStart + 24 <= headerSize; objectStart += objectSize) {
+    file.seekSet(objectStart);
+    if (file.read(buf, 24) != 24) break;
+    objectSize = le32(&buf[16]);
+    if (objectSize < 24) break;
+    if (!memcmp_P(buf, asf_file_properties_guid, 16)) {
+      if (file.read(buf, 80) != 80) break;
+      meta->packetCount = le32(&buf[32]);
+      /* Play duration is in 100ns units and includes the preroll in ms */
+      uint64_t playDuration = ((uint64_t)le32(&buf[44])) << 32 | le32(&buf[40]);
+      uint32_t preroll = le32(&buf[56]);
+      uint32_t msec = (uint32_t)(playDuration / 10000);
+      meta->duration = (msec > preroll) ? (uint16_t)((msec - preroll) / 1000) : 0;
+      if (le32(&buf[68]) == le32(&buf[72])) {
+        packetSize = le32(&buf[68]);
+      }
+      // Serial.print("duration: "); Serial.println(meta->duration);
+      // Serial.print("packetSize: "); Serial.println(packetSize);
+    }
+  }
+
+  /* Data Object follows the Header Object */
+  file.seekSet(headerSize);
+  if ((file.read(buf, 24) != 24) || memcmp_P(buf, asf_data_guid, 16)) {
+    meta->packetCount = 0;
+    return;
+  }
+  objectSize = le32(&buf[16]);
+  meta->start = headerSize + 50;
+
+  /* Top level objects following the Data Object */
+  if (objectSize >= 50) {
+    for (objectStart = headerSize + objectSize; objectStart + 24 <= fileSize; objectStart += objectSize) {
+      file.seekSet(objectStart);
+      if (file.read(buf, 24) != 24) break;
+      objectSize = le32(&buf[16]);
+      if (objectSize < 24) break;
+      if (!memcmp_P(buf, asf_simple_index_guid, 16)) {
+        if (file.read(buf, 32) != 32) break;
+        uint64_t interval = ((uint64_t)le32(&buf[20])) << 32 | le32(&buf[16]);
+        meta->indexInterval = (uint32_t)(interval / 10000);
+        meta->indexCount = le32(&buf[28]);
+        meta->indexOffset = objectStart + 56;
+        break;
+      }
+    }
+  }
 
+  if (packetSize && (packetSize <= 0xFFFF)) {
+    meta->blockAlign = packetSize;
+  } else {
+    meta->packetCount = 0;
+  }
+}
 
 //------------------------------------------------------------------------------
 /**
@@ -2081,7 +4681,7 @@ int16_t vs1053::getVUlevel() {
  */
 void vs1053::setBitRate(uint16_t bitr){
 
-  bitrate = bitr;
+  meta.bitrate = bitr;
   return;
 }
 
@@ -2191,13 +4791,7 @@ void vs1053::Mp3WriteRegister(uint8_t address, uint8_t msb, uint8_t lsb) {
     disableRefill();
   }
 
-  while(!digitalRead(MP3_DREQ));
-  cs_low();
-  SPI.transfer(0x02); // Write instruction
-  SPI.transfer(address);
-  SPI.transfer(msb);
-  SPI.transfer(lsb);
-  cs_high();
+  sciWrite(address, ((uint16_t)msb << 8) | lsb);
 
   /* Resume data */
   if(playing_state == playback) {
@@ -2206,6 +4800,147 @@ void vs1053::Mp3WriteRegister(uint8_t address, uint8_t msb, uint8_t lsb) {
   }
 }
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Write a VSdsp's register from within refill()
+ *
+ * \param[in] address of the VSdsp's register to be written
+ * \param[in] data to be written to the register
+ *
+ * Same as Mp3WriteRegister(), without pausing and resuming the refill, which
+ * would re-enter refill() while playing.
+ */
+void vs1053::sciWrite(uint8_t address, uint16_t data) {
+  spiInit(true);
+  sciWrite(MP3_XCS, MP3_DREQ, address, data);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Write a register of any VSdsp on the bus, the SPI being set up already
+ *
+ * \param[in] xcs control chip select pin of the VSdsp
+ * \param[in] dreq data request pin of the VSdsp
+ * \param[in] address of the VSdsp's register to be written
+ * \param[in] data to be written to the register
+ *
+ * The SCI write transaction all register writes come down to, those of the
+ * vs1053_decoder instances included.
+ */
+void vs1053::sciWrite(uint8_t xcs, uint8_t dreq, uint8_t address, uint16_t data) {
+  while(!digitalRead(dreq));
+  digitalWrite(xcs, LOW);
+  SPI.transfer(0x02); // Write instruction
+  SPI.transfer(address);
+  SPI.transfer(data >> 8);
+  SPI.transfer(data & 0xFF);
+  digitalWrite(xcs, HIGH);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read recorded data from SCI_HDAT0
+ *
+ * \param[out] buf buffer to be filled, with 2 bytes per word.
+ * \param[in] words number of words to read, as waiting in SCI_HDAT1.
+ * \param[in] isSwapped store each word LSB first, as the samples of a PCM WAV.
+ *
+ * Reads the words in one tight loop, with the SPI set up and DREQ checked
+ * once, rather than per Mp3ReadRegister(). Each word is shifted straight into
+ * the buffer MSB first, the byte order of the file, unless swapped.
+ *
+ * \note Each word still is a SCI read transaction of its own, framed by
+ * MP3_XCS, as SCI reads are one word long.
+ */
+void vs1053::readHdat0(uint8_t* buf, uint16_t words, bool isSwapped) {
+  uint8_t first = isSwapped ? 1 : 0;
+
+  while(!digitalRead(MP3_DREQ));
+  spiInit(false);
+  while (words--) {
+    digitalWrite(MP3_XCS, LOW);
+    SPI.transfer(0x03); // Read instruction
+    SPI.transfer(SCI_HDAT0);
+    buf[first] = SPI.transfer(0xFF); // MSB
+    buf[first ^ 1] = SPI.transfer(0xFF); // LSB
+    buf += 2;
+    digitalWrite(MP3_XCS, HIGH);
+  }
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read a VSdsp's register from within refill()
+ *
+ * \param[in] address of the VSdsp's register to be read
+ * \return result read from the register
+ *
+ * Same as Mp3ReadRegister(), without pausing and resuming the refill.
+ */
+uint16_t vs1053::sciRead(uint8_t address) {
+  spiInit(false); // Set up to read
+  return sciRead(MP3_XCS, MP3_DREQ, address);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read a register of any VSdsp on the bus, the SPI being set up already
+ *
+ * \param[in] xcs control chip select pin of the VSdsp
+ * \param[in] dreq data request pin of the VSdsp
+ * \param[in] address of the VSdsp's register to be read
+ * \return result read from the register
+ *
+ * The SCI read transaction all register reads come down to, at the read rate.
+ */
+uint16_t vs1053::sciRead(uint8_t xcs, uint8_t dreq, uint8_t address) {
+  union twobyte val;
+
+  while(!digitalRead(dreq));
+  digitalWrite(xcs, LOW); // Select control to read
+  //SCI consists of instruction byte, address byte, and 16-bit data word.
+  SPI.transfer(0x03); // Read instruction
+  SPI.transfer(address);
+  val.byte[1] = SPI.transfer(0xFF); // MSB
+  val.byte[0] = SPI.transfer(0xFF); // LSB
+  digitalWrite(xcs, HIGH); //Deselect Control
+  return val.word;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Sample the play position
+ *
+ * Reads the decode time, in seconds, and the 32-bit positionMsec. The two
+ * halves of positionMsec are read as the datasheet requires, the high half
+ * again when the low half may have carried over in between.
+ *
+ * Called by refill() every POSITION_SAMPLE_PERIOD, and for each buffer while
+ * fast forwarding, for skipTo() to stop on time.
+ */
+void vs1053::samplePosition() {
+  uint32_t second = position;
+  uint16_t msb;
+  uint16_t lsb;
+
+  positionReadAt = millis();
+  position = sciRead(SCI_DECODE_TIME);
+  sciWrite(SCI_WRAMADDR, para_positionMsec_1);
+  msb = sciRead(SCI_WRAM);
+  sciWrite(SCI_WRAMADDR, para_positionMsec_0);
+  lsb = sciRead(SCI_WRAM);
+  if (lsb < 0x8000) msb = sciRead(SCI_WRAM); // para_positionMsec_1, after any carry
+
+  if ((msb != 0xFFFF) || (lsb != 0xFFFF)) {
+    positionMsec = ((uint32_t)msb << 16) | lsb;
+    positionMsecAt = positionReadAt;
+  } else if (position != second) {
+    /* Not provided by the codec, the decode time just ticked */
+    positionMsec = position * 1000;
+    positionMsecAt = positionReadAt;
+  }
+}
+
 //------------------------------------------------------------------------------
 /**
  * \brief Read a VS10xx register
@@ -2219,26 +4954,20 @@ void vs1053::Mp3WriteRegister(uint8_t address, uint8_t msb, uint8_t lsb) {
 uint16_t vs1053::Mp3ReadRegister(uint8_t address){
   if(!digitalRead(MP3_RESET)) return 0;
 
-  union twobyte val;
+  uint16_t data;
   /* Pause data */
   if(playing_state == playback) {
     disableRefill();
   }
 
-  while(!digitalRead(MP3_DREQ)); 
-  cs_low(false); 
-  SPI.transfer(0x03); // Read instruction
-  SPI.transfer(address);
-  val.byte[1] = SPI.transfer(0xFF); // MSB
-  val.byte[0] = SPI.transfer(0xFF); // LSB
-  cs_high();
+  data = sciRead(address);
 
   /* Resume data */
   if(playing_state == playback) {
     refill();
     enableRefill();
   }
-  return val.word;
+  return data;
 }
 
 //------------------------------------------------------------------------------
@@ -2294,6 +5023,9 @@ void vs1053::Mp3WriteWRAM(uint16_t address, uint32_t data, bool is32bit) {
  *
  * Serves as a helper as to correspondingly run either the timer service or run
  * the refill() direclty, depending upon the configured means for refilling.
+ * Also carries on a catalog refresh in progress, one time slice per call,
+ * queues the following entry of a playlist, and feeds the vs1053_decoder
+ * instances begun.
  */
 void vs1053::available() {
 #if defined(USE_MP3_REFILL_MEANS) && USE_MP3_REFILL_MEANS == USE_MP3_SimpleTimer
@@ -2301,6 +5033,11 @@ void vs1053::available() {
 #elif defined(USE_MP3_REFILL_MEANS) && USE_MP3_REFILL_MEANS == USE_MP3_Polled
   refill();
 #endif
+  vs1053_catalog::available();
+#if USE_TRACK_QUEUE
+  vs1053_playlist::available();
+#endif
+  vs1053_decoder::available();
 }
 
 //------------------------------------------------------------------------------
@@ -2316,6 +5053,7 @@ void vs1053::available() {
  * When the filehandle's track indicates it is at the end of file. The track is
  * closed, the playing indicator is set to false, interrupts for refilling are
  * disabled and the VSdsp's data stream buffer is flushed appropiately.
+ * Unless a track was queued by queueNext(), which then carries on.
  */
 void vs1053::refill() {
 #if PERF_MON_PIN != -1
@@ -2334,17 +5072,48 @@ void vs1053::refill() {
 #endif
     /* Read data */
     if (bufferOffset == sizeof(mp3DataBuffer)) {
+      /* Get position, while DREQ is up, by each buffer while skipping */
+      if (isSkipping || (millis() - positionReadAt >= POSITION_SAMPLE_PERIOD)) samplePosition();
+#if USE_TRACK_QUEUE
+      if (nextTrack.isOpen() && (meta.format == mp3) && (nextMeta.format == mp3)) {
+        /* Gapless: the frames of the queued track follow straight, from the
+        end of this one's audio, before any ID3v1 tag */
+        uint32_t left = (meta.end > track.curPosition()) ? meta.end - track.curPosition() : 0;
+        int16_t len = track.read(mp3DataBuffer, (left < sizeof(mp3DataBuffer)) ? left : sizeof(mp3DataBuffer));
+        if (len < 0) len = 0;
+        if (len < (int16_t)sizeof(mp3DataBuffer)) {
+          track.close();
+          startQueued();
+          int16_t n = track.read(&mp3DataBuffer[len], sizeof(mp3DataBuffer) - len);
+          if (n > 0) len += n;
+          memset(&mp3DataBuffer[len], 0, sizeof(mp3DataBuffer) - len);
+        }
+      } else
+#endif
       if(!track.read(mp3DataBuffer, sizeof(mp3DataBuffer))) {
-        position = duration;
+        position = meta.duration;
+        if (playing_state == resyncing) sciWrite(SCI_VOL, ((uint16_t)VolL << 8) | VolR); // Ended while faded
         playing_state = cancelling;
-        /* track end */
+#if USE_TRACK_QUEUE
+        /* track end, the refill carrying on with a queued track */
+        if (!nextTrack.isOpen()) disableRefill();
+#else
         disableRefill();
+#endif
         uint16_t data = Mp3ReadWRAM(para_endFillByte);
         fillEnd((uint8_t)(data & 0x00FF));
         cancelDecoding(false, (uint8_t)(data & 0x00FF));
         track.close();
         playing_state = ready;
         Serial.println(F("Track end"));
+#if USE_TRACK_QUEUE
+        if (nextTrack.isOpen()) {
+          /* Start the queued track of another format */
+          startQueued();
+          playing_state = playback;
+          continue;
+        }
+#endif
         //Oh no! There is no data left to read!
         //Time to exit
         break;
@@ -2358,12 +5127,23 @@ void vs1053::refill() {
     if (playing_state == cancelling) {
       /* Cancelling when track is on going */
       disableRefill();
+      if (isResyncSet) {
+        /* Stopped while resyncing, maybe faded */
+        Mp3WriteWRAM(para_resync, seekResync);
+        Mp3WriteRegister(SCI_VOL, VolL, VolR);
+        isResyncSet = false;
+      }
       cancelDecoding(true);
       uint16_t data = Mp3ReadWRAM(para_endFillByte);
       fillEnd((uint8_t)(data & 0x00FF));
       track.close();
+#if USE_TRACK_QUEUE
+      if (nextTrack.isOpen()) nextTrack.close();
+#endif
       playing_state = ready;
       break;
+    } else if (playing_state == resyncing) {
+      if (resyncStep()) continue;
     } else if (playing_state == skipping) {
       if (!isSkipping) {
         if (position > skipToPosition) {
@@ -2377,6 +5157,8 @@ void vs1053::refill() {
           Mp3WriteRegister(SCI_DECODE_TIME, 0); // Reset decode time
           Mp3WriteRegister(SCI_DECODE_TIME, 0);
           position = 0;
+          positionMsec = 0;
+          positionMsecAt = millis();
           continue;
         }
         /* Skipping */
@@ -2394,16 +5176,6 @@ void vs1053::refill() {
     }
     bufferOffset += 32;
     dcs_high(); 
-    
-    /* Get position */
-    if (bufferOffset == sizeof(mp3DataBuffer)) {
-      cs_low(false); // Select control to read
-      //SCI consists of instruction byte, address byte, and 16-bit data word.
-      SPI.transfer(0x03);  //Read instruction
-      SPI.transfer(SCI_DECODE_TIME);
-      position = (((uint16_t)SPI.transfer(0xFF)) << 8) | SPI.transfer(0xFF); //Read the first byte
-      cs_high(); //Deselect Control
-    }
   }
   
   /* Check if skipping done */
@@ -2497,6 +5269,7 @@ void vs1053::enableRefill(bool isRecording) {
     Timer1.attachInterrupt(oggRefill);
 #endif
   } else {
+    isRefillEnabled = true;
 #if defined(USE_MP3_REFILL_MEANS) && USE_MP3_REFILL_MEANS == USE_MP3_Timer1
     Timer1.attachInterrupt( refill );
 #elif defined(USE_MP3_REFILL_MEANS) && USE_MP3_REFILL_MEANS == USE_MP3_SimpleTimer
@@ -2507,6 +5280,75 @@ void vs1053::enableRefill(bool isRecording) {
   }
 }
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Hold the refill while accessing the SdCard.
+ *
+ * The SdCard is shared with refill(), which may read the track from an
+ * interrupt. Other files are hence only accessed while it is held. That is
+ * whenever the refill is enabled, as while skipping or resyncing too.
+ *
+ * A recording drained by Timer1 writes the SdCard from oggRefill() likewise,
+ * so its drain is held as well.
+ *
+ * \return true when the refill was held, to be passed to releaseRefill().
+ */
+bool vs1053::holdRefill() {
+#if defined(OGG_REFILL_USING_TIMER)
+  if ((playing_state == recording) || (playing_state == finishing)) {
+    disableRefill(true);
+    return true;
+  }
+#endif
+  if (!isRefillEnabled) return false;
+  disableRefill();
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Release the refill held by holdRefill().
+ *
+ * \param[in] isHeld as returned by holdRefill().
+ *
+ * Catches up with the VSdsp's buffer, then re-enables the refill, unless the
+ * track was closed meanwhile. A recording's drain is re-attached to Timer1,
+ * at the period it was scheduled with.
+ */
+void vs1053::releaseRefill(bool isHeld) {
+  if (!isHeld) return;
+#if defined(OGG_REFILL_USING_TIMER)
+  if ((playing_state == recording) || (playing_state == finishing)) {
+    Timer1.attachInterrupt(oggRefill);
+    return;
+  }
+#endif
+  if (!track.isOpen()) return;
+  refill();
+  enableRefill();
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Borrow the buffer of the refill.
+ *
+ * Steps the playing track back over the data read but not fed yet, for
+ * refill() to read it again. Meanwhile mp3DataBuffer may be used as scratch,
+ * such as to probe other files.
+ *
+ * \return mp3DataBuffer, of BUFFER_SIZE bytes.
+ *
+ * \note The refill is expected to be held by the caller, until done with it.
+ */
+uint8_t* vs1053::borrowBuffer() {
+  if ((playing_state != recording) && (playing_state != finishing) && \
+      track.isOpen() && (bufferOffset < sizeof(mp3DataBuffer))) {
+    track.seekCur(-(int32_t)(sizeof(mp3DataBuffer) - bufferOffset));
+    bufferOffset = sizeof(mp3DataBuffer);
+  }
+  return mp3DataBuffer;
+}
+
 //------------------------------------------------------------------------------
 /**
  * \brief Disable the Interrupts for refill.
@@ -2520,6 +5362,7 @@ void vs1053::disableRefill(bool isRecording) {
     Timer1.detachInterrupt();
 #endif
   } else {
+    isRefillEnabled = false;
 #if defined(USE_MP3_REFILL_MEANS) && USE_MP3_REFILL_MEANS == USE_MP3_Timer1
     Timer1.detachInterrupt();
 #elif defined(USE_MP3_REFILL_MEANS) && USE_MP3_REFILL_MEANS == USE_MP3_SimpleTimer
@@ -2776,6 +5619,7 @@ format_m getTrackFormat(char *filename) {
   
   if (strstr(strlwr(filename + (len - 4)), ".mp3")) return mp3;
   else if (strstr(strlwr(filename + (len - 4)), ".aac")) return aac;
+  else if (strstr(strlwr(filename + (len - 4)), ".m4a")) return aac;
   else if (strstr(strlwr(filename + (len - 4)), ".wma")) return wma;
   else if (strstr(strlwr(filename + (len - 4)), ".wav")) return wav;
   else if (strstr(strlwr(filename + (len - 4)), ".fla")) return fla;
@@ -2784,6 +5628,31 @@ format_m getTrackFormat(char *filename) {
   else return unknownFormat;
 }
 
+/**
+ * \brief is the content music
+ *
+ * \param[in] head the first bytes of the file, following any ID3v2 tag.
+ * \param[in] len number of valid bytes in head.
+ *
+ * Sniffs the magic bytes of the containers, and the frame sync of the raw
+ * streams, that VS10xx can decode.
+ *
+ * \return the format of the content, unknownFormat when not recognized.
+ */
+format_m getTrackFormat(const uint8_t *head, uint16_t len) {
+  if (len < 4) return unknownFormat;
+
+  if (!memcmp(head, "OggS", 4)) return ogg;
+  else if (!memcmp(head, "fLaC", 4)) return fla;
+  else if (!memcmp(head, "MThd", 4)) return mid;
+  else if ((len >= 12) && !memcmp(head, "RIFF", 4) && !memcmp(&head[8], "WAVE", 4)) return wav;
+  else if ((len >= 8) && !memcmp(&head[4], "ftyp", 4)) return aac;
+  else if ((len >= 30) && !memcmp_P(head, asf_header_guid, 16)) return wma;
+  else if ((head[0] == 0xFF) && ((head[1] & 0xF6) == 0xF0)) return aac; // ADTS, layer 0
+  else if ((head[0] == 0xFF) && ((head[1] & 0xE0) == 0xE0) && (head[1] & 0x06)) return mp3;
+  else return unknownFormat;
+}
+
 bool isFormat(format_m targetFormat, char *filename) {
   format_m format = getTrackFormat(filename);
   if ((format == targetFormat) || ((targetFormat == supportedFormat) && (format != unknownFormat)))
@@ -40,6 +40,7 @@ enum state_m {
   paused_playback,
   cancelling,
   skipping,
+  resyncing,
   recording,
   finishing,
   testing_memory,
@@ -96,6 +97,119 @@ enum flush_m {
   none
   }; //enum flush_m
 
+/** \brief A point of the seek table
+ *
+ * Pairs a playing time with the file offset where decoding may resume, as
+ * extracted from the sample tables of MP4/M4A (AAC) tracks.
+ */
+struct seek_point_m {
+  uint16_t seconds;
+  uint32_t offset;
+}; //struct seek_point_m
+
+/** \brief Stream layout of a track
+ *
+ * As probed from the content of a track, ahead of playing it, and used to
+ * locate its audio data, duration and decodable file offsets.
+ */
+struct track_meta_m {
+/** \brief format sniffed from the magic bytes of the track.*/
+  format_m format;
+/** \brief estimate playable duration in second, zero when unknown.*/
+  uint16_t duration;
+/** \brief beleived bit-rate in bytes per millisecond, of MP3 tracks.*/
+  uint8_t bitrate;
+/** \brief number of valid points in the seek table, of MP4/M4A tracks.*/
+  uint8_t seekPoints;
+/** \brief size in bytes of one sample frame (or ADPCM block, or ASF packet).*/
+  uint16_t blockAlign;
+/** \brief file offset of the first audio frame, or data chunk, or ASF packet.*/
+  uint32_t start;
+/** \brief file offset ending the audio of MP3 tracks, before any ID3v1 tag.
+ * The file size otherwise.*/
+  uint32_t end;
+/** \brief exact byte rate in bytes per second, when known from the header.*/
+  uint32_t byteRate;
+/** \brief number of ASF data packets.*/
+  uint32_t packetCount;
+/** \brief file offset of the first entry of the ASF Simple Index, if any.*/
+  uint32_t indexOffset;
+  uint32_t indexCount;
+/** \brief time interval between ASF Simple Index entries in milliseconds.*/
+  uint32_t indexInterval;
+}; //struct track_meta_m
+
+/** \brief Tag information of a track
+ *
+ * The fields of the track's tag, read once when the track is opened. Text is
+ * folded to ASCII, with trailing padding stripped and always terminated.
+ */
+struct track_tag_m {
+  char title[TRACK_TAG_LENGTH];
+  char artist[TRACK_TAG_LENGTH];
+  char album[TRACK_TAG_LENGTH];
+/** \brief number of the track in its album, zero when unknown.*/
+  uint8_t number;
+/** \brief ReplayGain of the track in hundredths of a dB.*/
+  int16_t trackGain;
+/** \brief ReplayGain of the album in hundredths of a dB.*/
+  int16_t albumGain;
+}; //struct track_tag_m
+
+/** \brief Statistics of a recording
+ *
+ * As gathered by the drains of the VSdsp's recording buffer, since
+ * vs1053::recordOgg().
+ */
+struct record_stats_m {
+/** \brief number of drains of the recording buffer.*/
+  uint32_t drains;
+/** \brief period scheduled for the next drain, in microseconds.*/
+  uint32_t period;
+/** \brief most words found waiting in the recording buffer.*/
+  uint16_t maxWaiting;
+/** \brief least room left in the recording buffer, in words.*/
+  uint16_t minMargin;
+/** \brief drains finding at least RECORD_OVERFLOW_WORDS waiting.*/
+  uint16_t overflows;
+/** \brief words estimated lost to full buffers, from the encoder's rate.*/
+  uint32_t lostWords;
+/** \brief bytes written to the file.*/
+  uint32_t bytes;
+/** \brief average bytes written per second.*/
+  uint32_t bytesPerSecond;
+/** \brief longest write to the SdCard, in microseconds.*/
+  uint32_t writeMax;
+/** \brief 99th percentile of the writes to the SdCard, in microseconds.
+ * Rounded up to a power of two, as taken from a histogram.*/
+  uint32_t writeP99;
+/** \brief bytes sent to the recording stream.*/
+  uint32_t streamBytes;
+/** \brief bytes dropped as the recording stream's queue was full.*/
+  uint32_t streamDropped;
+/** \brief microseconds taken to start the recording, profile loading included.*/
+  uint32_t startLatency;
+}; //struct record_stats_m
+
+/** \brief Progress through a plugin being loaded
+ *
+ * As of VLSI's compressed plugin format: runs of an address, a count, then
+ * either the count's words or, with its bit 15 set, one word to replicate.
+ */
+struct plugin_loader_m {
+/** \brief the VSdsp's register the run is written to.*/
+  uint16_t address;
+/** \brief words left to be written by the run.*/
+  uint16_t left;
+/** \brief next word expected: 0 address, 1 count, 2 replicated word, 3 copied words.*/
+  uint8_t phase;
+/** \brief control chip select and data request pins of the VSdsp loaded.*/
+  uint8_t xcs;
+  uint8_t dreq;
+/** \brief the run's SCI multiple write is under way, XCS being held low.*/
+  bool isSelected;
+}; //struct plugin_loader_m
+
 //------------------------------------------------------------------------------
 /** \name External_Variable_Group
  *  External Variables accessed by other files.
@@ -593,7 +707,7 @@ extern SdFat sd;
  * \brief A macro of the WRAM para_positionMsec_0 register's address (R/W)
  *
  * para_positionMsec_0 is a Read/Write Extra Parameter in X memory, accessed indirectly
- * with the SCI_WRAMADDR and SCI_WRAM. Corresponding to the high 16 bit value of positionMsec
+ * with the SCI_WRAMADDR and SCI_WRAM. Corresponding to the low 16 bit value of positionMsec
  *
  * positionMsec is a field that gives the current play position in a file in milliseconds, regardless
  * of rewind and fast forward operations. The value is only available in codecs that can determine
@@ -712,19 +826,37 @@ class vs1053 {
     uint8_t getDifferentialOutput();
     uint8_t playTrack(uint8_t);
     uint8_t play(char*, uint32_t timecode = 0);
+    uint8_t play(uint16_t, uint32_t timecode = 0);
+    int32_t findNextTrack(int32_t dirIndex = -1);
+#if USE_TRACK_QUEUE
+    uint8_t queueNext(char*);
+    uint8_t queueNext(uint16_t);
+#endif
     void trackTitle(char*);
     void trackArtist(char*);
     void trackAlbum(char*);
+    uint8_t trackNumber();
+    int16_t trackReplayGain(bool isAlbum = false);
     uint32_t getDuration();
     void stop();
-    uint8_t recordOgg(const char*, const char*, bool);
+    uint8_t recordOgg(const char*, const char*, bool, uint32_t maxSize = 0);
+    uint8_t recordOgg(const char*, const uint16_t*, uint16_t, bool, uint32_t maxSize = 0);
+    void keepEncoder(bool);
+    uint8_t recordWav(const char*, uint16_t sampleRate = 8000, bool isStereo = false, bool isAdpcm = true, uint32_t maxSize = 0);
     uint8_t writeOggInLoop();
     void stopRecord();
+    void setRecordingRotation(uint16_t, uint16_t megabytes = 0);
+    void setPreTrigger(uint8_t*, uint16_t);
+    void triggerRecord();
+    void setVoiceActivation(uint16_t, uint16_t, uint16_t, uint16_t);
+    void setRecordingStream(Stream*, uint8_t*, uint16_t);
     uint16_t getRecordingLevel();
+    void getRecordingStats(record_stats_m*);
     uint8_t isBusy();
     uint8_t skip(int32_t);
     uint8_t skipTo(uint32_t);
     uint32_t currentPosition();
+    uint32_t currentPositionMsec();
     void setBitRate(uint16_t);
     void pauseMusic();
     uint8_t resumeMusic(uint32_t timecode=0xFFFFFFFF);
@@ -741,12 +873,31 @@ class vs1053 {
     void SendSingleMIDInote();
 
   private:
+    friend class vs1053_catalog;
+    friend class vs1053_playlist;
+    friend class vs1053_decoder;
     static SdFile track;
     static void refill();
     static void cancelDecoding(bool, uint8_t fillingByte=0x00);
     static void fillEnd(uint8_t);
     static void flush_cancel(flush_m);
     static uint8_t oggRefill();
+    static uint8_t openRecorded(const char*, uint32_t);
+    static bool writeRecorded(const uint8_t*, uint16_t);
+    static uint16_t wavHeader(uint8_t*, uint32_t);
+    static void recordFileName(char*, uint16_t);
+    static uint16_t recordSplit(const uint8_t*, uint16_t);
+    static uint16_t oggPageStart(const uint8_t*, uint16_t);
+    static bool isRotationDue();
+    static uint8_t rotateRecorded();
+    static bool storeRecorded(const uint8_t*, uint16_t);
+    static bool commitRing();
+    static bool switchRecorded();
+    static bool emitRecorded(const uint8_t*, uint16_t);
+    static void drainStream(bool);
+    static void updateVoiceActivation();
+    static void scheduleDrain(uint16_t, uint16_t);
+    static void closeRecorded();
     static void spiInit(bool);
     static void cs_low(bool toWrite=true);
     static void cs_high();
@@ -754,20 +905,53 @@ class vs1053 {
     static void dcs_high();
     static void Mp3WriteRegister(uint8_t, uint8_t, uint8_t);
     static void Mp3WriteRegister(uint8_t, uint16_t);
+    static void sciWrite(uint8_t, uint16_t);
+    static uint16_t sciRead(uint8_t);
+    static void sciWrite(uint8_t, uint8_t, uint8_t, uint16_t);
+    static uint16_t sciRead(uint8_t, uint8_t, uint8_t);
+    static void readHdat0(uint8_t*, uint16_t, bool isSwapped = false);
+    static void samplePosition();
     static uint16_t Mp3ReadRegister(uint8_t);
     static uint32_t Mp3ReadWRAM(uint16_t, bool is32bit=false);
     static void Mp3WriteWRAM(uint16_t, uint32_t, bool is32bit=false);
-    void getTrackInfo(uint8_t, char*);
+    static uint32_t getID3v2Tag(SdFile&, track_tag_m*, track_meta_m*, uint8_t*);
+    static void getID3v1Tag(SdFile&, track_tag_m*, uint8_t*);
     static void enableRefill(bool isRecording=false);
     static void disableRefill(bool isRecording=false);
-    void getBitRateFromMP3File();
-    void getOggInfo();
+    static bool holdRefill();
+    uint8_t startTrack(char*, uint32_t);
+#if USE_TRACK_QUEUE
+    static uint8_t queueTrack(char*);
+    static void startQueued();
+#endif
+    static void releaseRefill(bool);
+    static uint8_t* borrowBuffer();
+    static format_m probeTrack(SdFile&, track_meta_m*, track_tag_m*, uint8_t*, seek_point_m*);
+    static void getBitRateFromMP3File(SdFile&, track_meta_m*, uint8_t*, int16_t, uint32_t);
+    static void getOggInfo(SdFile&, track_meta_m*, track_tag_m*, uint8_t*);
+    static void getWavInfo(SdFile&, track_meta_m*, uint8_t*);
+    static void getMp4Info(SdFile&, track_meta_m*, uint8_t*, seek_point_m*);
+    static uint32_t readMp4Word(SdFile&, uint32_t);
+    static void getWmaInfo(SdFile&, track_meta_m*, uint8_t*);
+    bool isSeekable();
+    static bool findMp3Frame(SdFile&, uint32_t*, uint8_t*);
+    static bool resyncStep();
+    uint8_t jumpTo(uint32_t, uint16_t);
     uint8_t VSLoadUserCode(const char*);
+    uint8_t VSLoadUserCode(const uint16_t*, uint16_t);
     uint8_t VSLoadImage(const char*, uint16_t*);
+    static uint8_t loadPluginFile(SdFile&, const char*, uint8_t*, uint16_t, plugin_loader_m*);
+    static void loadPluginWord(plugin_loader_m*, uint16_t);
+    static void releasePluginRun(plugin_loader_m*);
+    uint8_t startOgg(const char*, const char*, const uint16_t*, uint16_t, bool, uint32_t);
+    static void releaseEncoder();
+    static void checkStartLatency(uint32_t);
 
     static bool isPatched;
     static bool isSkipping;
     
+/** \brief the refill of the track is enabled, as held by holdRefill().*/
+    static bool isRefillEnabled;
 /** \brief Boolean flag indicating if filehandle is streaming.*/
     static state_m playing_state;
 
@@ -780,20 +964,125 @@ class vs1053 {
     static uint16_t bufferOffset;
 
     static uint16_t registers_backup[3];
+/** \brief the encoder stays loaded between recordings, as set by keepEncoder(),
+ * and is loaded, with the profile from keptProfileName or keptProfile.*/
+    static bool isEncoderKept;
+    static bool isEncoderLoaded;
+    static char keptProfileName[13];
+    static const uint16_t* keptProfile;
     
-    static format_m trackFormat;
-/** \brief contains a local value of the current track estimate playable duration in second.*/
-    static uint16_t duration;
+/** \brief contains the stream layout of the current track, as probed by play().*/
+    static track_meta_m meta;
     static uint32_t position;
+/** \brief play position in milliseconds, as of positionMsecAt in millis().*/
+    static uint32_t positionMsec;
+    static uint32_t positionMsecAt;
+/** \brief millis() of the last sampling of the play position.*/
+    static uint32_t positionReadAt;
     static uint16_t skipToPosition;
+/** \brief frame aligned file offset and progress of a MP3 seek, processed by refill().*/
+    static uint32_t seekOffset;
+    static uint8_t seekStep;
+/** \brief para_resync before a MP3 seek, restored once resynced.*/
+    static uint16_t seekResync;
+    static bool isResyncSet;
+/** \brief contains the seek points of the current track, if its container provides them.*/
+    static seek_point_m seekTable[SEEK_TABLE_SIZE];
+/** \brief contains the tag information of the current track, as read by play().*/
+    static track_tag_m tag;
+#if USE_TRACK_QUEUE
+/** \brief filehandle of the track queued by queueNext(), with its layout and tag.*/
+    static SdFile nextTrack;
+    static track_meta_m nextMeta;
+    static track_tag_m nextTag;
+/** \brief number of tracks started by play(), queued ones excluded.*/
+    static uint16_t playCount;
+#endif
     static bool isRecordingStereo;
+/** \brief format of the recording, ogg or wav, and the WAV's sample rate, header size and encoding.*/
+    static format_m recordFormat;
+    static uint16_t recordSampleRate;
+    static uint16_t recordHeaderSize;
+    static bool isRecordingPcm;
     static uint16_t recordingLevel;
-    
-/** \brief contains a local value of the beleived current bit-rate.*/
-    uint8_t bitrate;
+/** \brief a recording into a preallocated contiguous file, written by blocks.*/
+    static bool isContiguous;
+/** \brief next and end block of the contiguous recording file.*/
+    static uint32_t recordBlock;
+    static uint32_t recordEndBlock;
+/** \brief bytes recorded into the current file, and those of them waiting in sectorBuffer.*/
+    static uint32_t recordLength;
+    static uint16_t sectorFill;
+/** \brief the SdFat volume's cache, borrowed as sector buffer.*/
+    static uint8_t* sectorBuffer;
+/** \brief micros() and words left at the last drain, and the encoder's output
+ * rate in words per microsecond, as 16.16 fixed point.*/
+    static uint32_t drainedAt;
+    static uint16_t drainLeft;
+    static uint32_t drainRate;
+    static record_stats_m recordStats;
+/** \brief name of the first file of the recording, and number of the current one.*/
+    static char recordName[RECORD_PATH_LENGTH];
+    static uint16_t recordFileNo;
+/** \brief size to preallocate each file of the recording to, as given to recordOgg().*/
+    static uint32_t recordMaxSize;
+/** \brief period and size after which recordings switch to a new file, zero if none.*/
+    static uint32_t rotateMsec;
+    static uint32_t rotateBytes;
+/** \brief the recording switches to new files, and millis() when the current one was opened.*/
+    static bool isRotating;
+    static uint32_t recordFileAt;
+/** \brief progress through the Ogg pages recorded: byte of the page header,
+ * segments of the page, bytes left to the next page, and the page's file offset.*/
+    static uint8_t oggPageAt;
+    static uint8_t oggSegments;
+    static uint16_t oggPageLeft;
+    static uint32_t oggPageOffset;
+    static bool isOggAudio;
+/** \brief ring of the pre-trigger capture as set by setPreTrigger(), and the
+ * bytes stored to it since recording started.*/
+    static uint8_t* ringBuffer;
+    static uint16_t ringSize;
+    static uint32_t ringTotal;
+/** \brief the recording cycles through the ring, until triggered.*/
+    static bool isArmed;
+    static volatile bool isTriggered;
+/** \brief ring bytes already written to the file, when armed again.*/
+    static uint32_t ringCommitted;
+/** \brief bytes produced by the encoder since recording started.*/
+    static uint32_t recordProduced;
+/** \brief bytes sent to the file or the stream since recording started.*/
+    static uint32_t recordEmitted;
+/** \brief levels opening and closing the voice activated gate, and the
+ * milliseconds they must last, as set by setVoiceActivation().*/
+    static uint16_t voxStartLevel;
+    static uint16_t voxStopLevel;
+    static uint16_t voxAttack;
+    static uint16_t voxHang;
+/** \brief the gate follows the recording level, and millis() since when the
+ * level asks for it to open or close.*/
+    static bool isVoxActive;
+    static bool isVoxPending;
+    static uint32_t voxSince;
+/** \brief the gate closes at the next page or block boundary.*/
+    static bool isVoxClosing;
+/** \brief the recording has a file, rather than only a stream.*/
+    static bool isRecordingFile;
+/** \brief stream the recording is sent to, as set by setRecordingStream(),
+ * and its queue: buffer, size, first byte and number of bytes queued.*/
+    static Stream* recordStream;
+    static uint8_t* streamQueue;
+    static uint16_t streamQueueSize;
+    static uint16_t streamHead;
+    static uint16_t streamQueued;
+/** \brief the queue overflowed, data is dropped up to the next page or block boundary.*/
+    static bool isStreamDropping;
+/** \brief peak of the PCM samples since the last recording level.*/
+    static uint16_t recordingPeak;
+/** \brief millis() when recording started, and the histogram of write latencies.*/
+    static uint32_t recordStartedAt;
+    static uint32_t writeLatency[RECORD_LATENCY_BUCKETS];
 
-/** \brief contains a filehandles offset to the begining of the current file.*/
-    uint32_t start_of_music;
 
 /** \brief contains a local value of the VSdsp's master volume left channels*/
     static uint8_t VolL;
@@ -836,6 +1125,7 @@ union sci_bass_m {
  */
 char* strip_nonalpha_inplace(char *s);
 format_m getTrackFormat(char*);
+format_m getTrackFormat(const uint8_t*, uint16_t);
 bool isFormat(format_m, char*);
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,606 @@
+/**
+\file vs1053_SdFat_catalog.cpp
+
+\brief Code file for the media catalog of the vs1053 library
+\remarks comments are implemented with Doxygen Markdown format
+
+*/
+
+#include <vs1053_SdFat_catalog.h>
+#include <stddef.h>
+//avr pgmspace library for storing the strings in program flash instead of sram
+#include <avr/pgmspace.h>
+
+vs1053_catalog* vs1053_catalog::refreshing;
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Constructor of the vs1053_catalog class.
+ */
+vs1053_catalog::vs1053_catalog() {
+  memset(&header, 0, sizeof(header));
+  memset(&updateHeader, 0, sizeof(updateHeader));
+  phase = refreshIdle;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Build the catalog of a folder
+ *
+ * \param[in] folder path of the folder to be cataloged.
+ *
+ * Scans the entries of the folder once, probing the content of each file with
+ * vs1053::probeTrack(). Files of a format the VSdsp can decode are summarized
+ * into fixed size records, written in directory order into the folder's
+ * CATALOG_FILE. A hash index of the file names, sorted in place, follows the
+ * records for find().
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ *
+ * \note The catalog is left open for get() and find().
+ */
+uint8_t vs1053_catalog::build(const char* folder) {
+  uint8_t result;
+
+  close();
+  result = startRefresh(folder, false);
+  while (!result && isRefreshing()) {
+    result = refreshStep(0xFFFF);
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Start refreshing the catalog of a folder
+ *
+ * \param[in] folder path of the folder, as given to build().
+ *
+ * Opens the current catalog, then starts writing an updated one into
+ * CATALOG_NEW_FILE. Files whose directory entry still has the modification
+ * date, time and size of their record are copied over, only new or changed
+ * files are probed. The refresh is then carried on by refreshStep(), which
+ * available() calls in time slices, and replaces the catalog once complete.
+ *
+ * An unfinished refresh of the same folder, such as one stopped by a power
+ * loss, is resumed rather than restarted.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t vs1053_catalog::refresh(const char* folder) {
+  open(folder); // a missing catalog only means all files are probed
+  return startRefresh(folder, true);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Carry on the refresh of the catalog
+ *
+ * \param[in] msec time slice to work for, in milliseconds.
+ *
+ * Scans directory entries, then writes and sorts the hash index, until the
+ * time slice is used. At least one step is done on each call, the probing of
+ * one file taking as long as it needs. Progress is saved into
+ * CATALOG_NEW_FILE at the end of each slice.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t vs1053_catalog::refreshStep(uint16_t msec) {
+  uint32_t started = millis();
+  uint32_t indexOffset = sizeof(catalog_header_m) + (uint32_t)updateHeader.count * sizeof(catalog_record_m);
+  catalog_index_m index, other;
+  bool isHeld;
+  bool isOk = true;
+
+  if (phase == refreshIdle) return 0;
+  do {
+    if (phase == refreshScanning) {
+      if (!scanEntry()) {
+        updateHeader.cursor = CATALOG_SCANNED;
+        sortNext = 0;
+        phase = refreshIndexing;
+      }
+      isOk = update.isOpen();
+    } else if (phase == refreshIndexing) {
+      /* Hash index, following the records */
+      if (sortNext < updateHeader.count) {
+        isHeld = vs1053::holdRefill();
+        isOk = update.seekSet(sizeof(catalog_header_m) + (uint32_t)sortNext * sizeof(catalog_record_m)) && \
+               (update.read(&index.hash, sizeof(index.hash)) == sizeof(index.hash));
+        index.record = sortNext;
+        isOk = isOk && writeIndex(update, indexOffset, sortNext++, &index);
+        vs1053::releaseRefill(isHeld);
+      } else {
+        /* Shell sort in place, with Knuth's gap sequence */
+        for (sortGap = 1; sortGap < updateHeader.count / 3; sortGap = sortGap * 3 + 1);
+        sortNext = sortGap;
+        phase = refreshSorting;
+      }
+    } else if (phase == refreshSorting) {
+      if (sortNext < updateHeader.count) {
+        uint16_t j = sortNext;
+        isHeld = vs1053::holdRefill();
+        isOk = readIndex(update, indexOffset, sortNext, &index);
+        while (isOk && (j >= sortGap) && readIndex(update, indexOffset, j - sortGap, &other) && (other.hash > index.hash)) {
+          isOk = writeIndex(update, indexOffset, j, &other);
+          j -= sortGap;
+        }
+        if (isOk && (j != sortNext)) isOk = writeIndex(update, indexOffset, j, &index);
+        vs1053::releaseRefill(isHeld);
+        sortNext++;
+      } else if (sortGap > 1) {
+        sortGap /= 3;
+        sortNext = sortGap;
+      } else {
+        updateHeader.indexOffset = indexOffset;
+        return finishRefresh();
+      }
+    }
+  } while (isOk && (millis() - started < msec));
+
+  /* Save the progress */
+  isHeld = vs1053::holdRefill();
+  isOk = isOk && update.seekSet(0) && (update.write(&updateHeader, sizeof(updateHeader)) == sizeof(updateHeader));
+  isOk = isOk && update.sync();
+  vs1053::releaseRefill(isHeld);
+  if (!isOk) {
+    cancelRefresh();
+    return 4;
+  }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Indicate if a refresh of the catalog is in progress
+ *
+ * \return true until the refresh started by build() or refresh() completes.
+ */
+bool vs1053_catalog::isRefreshing() {
+  return phase != refreshIdle;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Carry on the refresh in progress, if any
+ *
+ * Called by vs1053::available(), so that a refresh runs in time slices of
+ * CATALOG_REFRESH_SLICE from the main loop.
+ */
+void vs1053_catalog::available() {
+  if (refreshing) refreshing->refreshStep();
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Open the catalog of a folder
+ *
+ * \param[in] path path of the folder, as given to build().
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t vs1053_catalog::open(const char* path) {
+  bool isHeld;
+  uint8_t result;
+
+  close();
+  isHeld = vs1053::holdRefill();
+  if (!folder.open(path, O_READ)) {
+    vs1053::releaseRefill(isHeld);
+    return 2;
+  }
+  result = openIn(folder);
+  if (result) folder.close();
+  vs1053::releaseRefill(isHeld);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Close the catalog
+ *
+ * \note A refresh in progress is left to be resumed by refresh().
+ */
+void vs1053_catalog::close() {
+  bool isHeld;
+
+  cancelRefresh();
+  isHeld = vs1053::holdRefill();
+  if (catalog.isOpen()) catalog.close();
+  if (folder.isOpen()) folder.close();
+  vs1053::releaseRefill(isHeld);
+  memset(&header, 0, sizeof(header));
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Number of records in the catalog
+ *
+ * \return the number of playable files cataloged, zero when not open.
+ */
+uint16_t vs1053_catalog::count() {
+  return header.count;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Browse the catalog
+ *
+ * \param[in] n record number, in directory order.
+ * \param[out] record to be updated with the record read.
+ *
+ * \return
+ * - 0 indicates the record was read.
+ * - 1 indicates n is beyond the catalog.
+ * - 2 indicates failure to read the catalog.
+ */
+uint8_t vs1053_catalog::get(uint16_t n, catalog_record_m* record) {
+  bool isHeld;
+  bool isOk;
+
+  if (n >= header.count) return 1;
+  isHeld = vs1053::holdRefill();
+  isOk = catalog.seekSet(sizeof(header) + (uint32_t)n * sizeof(catalog_record_m)) && \
+         (catalog.read(record, sizeof(catalog_record_m)) == sizeof(catalog_record_m));
+  vs1053::releaseRefill(isHeld);
+  return isOk ? 0 : 2;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Search the catalog by file name
+ *
+ * \param[in] name name of the file, within the cataloged folder. Not case
+ * sensitive.
+ * \param[out] record (optional) to be updated with the record found.
+ *
+ * Binary search of the first entry of the name's hash in the catalog's hash
+ * index. As other names may share the hash, the entries of that hash are then
+ * checked in turn against the name of their file's directory entry.
+ *
+ * \return the record number, or -1 when not found.
+ */
+int32_t vs1053_catalog::find(const char* name, catalog_record_m* record) {
+  catalog_index_m index;
+  uint32_t key = hash(name);
+  uint16_t low = 0;
+  uint16_t high = header.count;
+  bool isHeld;
+  bool isOk;
+
+  while (low < high) {
+    uint16_t mid = low + (high - low) / 2;
+    isHeld = vs1053::holdRefill();
+    isOk = readIndex(catalog, header.indexOffset, mid, &index);
+    vs1053::releaseRefill(isHeld);
+    if (!isOk) return -1;
+    if (index.hash < key) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  for ( ; low < header.count; low++) {
+    isHeld = vs1053::holdRefill();
+    isOk = readIndex(catalog, header.indexOffset, low, &index) && (index.hash == key);
+    vs1053::releaseRefill(isHeld);
+    if (!isOk) break;
+    if (isNamed(index.record, name)) {
+      if (record && get(index.record, record)) return -1;
+      return index.record;
+    }
+  }
+  return -1;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Hash a file name
+ *
+ * \param[in] name name of the file.
+ *
+ * \return the 32-bit FNV-1a hash of the lower case name.
+ */
+uint32_t vs1053_catalog::hash(const char* name) {
+  uint32_t h = 2166136261UL;
+  while (*name) {
+    h ^= (uint8_t)tolower(*name++);
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Check the name of a record's file
+ *
+ * \param[in] n record number.
+ * \param[in] name name searched by find(). Not case sensitive.
+ *
+ * Opens the file by the directory index of its record, its name being read
+ * into vs1053's buffer. The position of the folder, scanned by a refresh, is
+ * kept.
+ *
+ * \return true when the file of the record has this name.
+ */
+bool vs1053_catalog::isNamed(uint16_t n, const char* name) {
+  SdFile entry;
+  uint16_t dirIndex;
+  uint32_t position;
+  bool isHeld;
+  bool isOk;
+
+  isHeld = vs1053::holdRefill();
+  position = folder.curPosition();
+  isOk = catalog.seekSet(sizeof(header) + (uint32_t)n * sizeof(catalog_record_m) + offsetof(catalog_record_m, dirIndex)) && \
+         (catalog.read(&dirIndex, sizeof(dirIndex)) == sizeof(dirIndex)) && entry.open(&folder, dirIndex, O_READ);
+  if (isOk) {
+    char* entryName = (char*)vs1053::borrowBuffer();
+    isOk = entry.getName(entryName, BUFFER_SIZE) && !strcasecmp(entryName, name);
+    entry.close();
+  }
+  folder.seekSet(position);
+  vs1053::releaseRefill(isHeld);
+  return isOk;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Open the catalog within an open folder
+ *
+ * \param[in] dir filehandle of the cataloged folder.
+ *
+ * Completes the replacement of the catalog by a refresh, when that was
+ * interrupted by a power loss.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \note The refill is expected to be held by the caller.
+ */
+uint8_t vs1053_catalog::openIn(SdFile& dir) {
+  if (!catalog.open(&dir, CATALOG_FILE, O_READ) && catalog.open(&dir, CATALOG_NEW_FILE, O_RDWR)) {
+    /* Replaced by a complete refresh, but not yet renamed */
+    if ((catalog.read(&header, sizeof(header)) != sizeof(header)) || !header.indexOffset || \
+        !catalog.rename(&dir, CATALOG_FILE)) {
+      catalog.close();
+    }
+  }
+  if (!catalog.isOpen() || !catalog.seekSet(0) || \
+      (catalog.read(&header, sizeof(header)) != sizeof(header)) || \
+      memcmp_P(header.magic, PSTR("VSC"), 3) || (header.magic[3] != CATALOG_VERSION) || \
+      (header.recordSize != sizeof(catalog_record_m)) || !header.indexOffset) {
+    if (catalog.isOpen()) catalog.close();
+    memset(&header, 0, sizeof(header));
+    return 3;
+  }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Open the files of a refresh
+ *
+ * \param[in] path path of the folder.
+ * \param[in] isResumable true to resume an unfinished refresh of the folder.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ */
+uint8_t vs1053_catalog::startRefresh(const char* path, bool isResumable) {
+  bool isHeld;
+  bool isResumed = false;
+
+  cancelRefresh();
+  isHeld = vs1053::holdRefill();
+  if (!folder.isOpen() && !folder.open(path, O_READ)) {
+    vs1053::releaseRefill(isHeld);
+    return 2;
+  }
+  if (isResumable && update.open(&folder, CATALOG_NEW_FILE, O_RDWR) && \
+      (update.read(&updateHeader, sizeof(updateHeader)) == sizeof(updateHeader)) && \
+      !memcmp_P(updateHeader.magic, PSTR("VSC"), 3) && (updateHeader.magic[3] == CATALOG_VERSION) && \
+      (updateHeader.recordSize == sizeof(catalog_record_m)) && !updateHeader.indexOffset) {
+    if (updateHeader.cursor == CATALOG_SCANNED) {
+      sortNext = 0;
+      phase = refreshIndexing;
+      isResumed = true;
+    } else if (folder.seekSet(updateHeader.cursor)) {
+      phase = refreshScanning;
+      isResumed = true;
+    }
+  }
+  if (!isResumed) {
+    if (update.isOpen()) update.close();
+    memset(&updateHeader, 0, sizeof(updateHeader));
+    memcpy_P(updateHeader.magic, PSTR("VSC"), 3);
+    updateHeader.magic[3] = CATALOG_VERSION;
+    updateHeader.recordSize = sizeof(catalog_record_m);
+    if (!update.open(&folder, CATALOG_NEW_FILE, O_RDWR | O_CREAT | O_TRUNC) || \
+        (update.write(&updateHeader, sizeof(updateHeader)) != sizeof(updateHeader)) || !update.sync()) {
+      update.close();
+      if (!catalog.isOpen()) folder.close();
+      vs1053::releaseRefill(isHeld);
+      return 3;
+    }
+    phase = refreshScanning;
+  }
+  vs1053::releaseRefill(isHeld);
+  refreshing = this;
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Scan the next entry of the folder being refreshed
+ *
+ * Copies the current record of the file when its directory entry did not
+ * change, otherwise probes it. Files of a format the VSdsp cannot decode are
+ * skipped.
+ *
+ * The directory entry, and the probe's results, are scoped apart to share
+ * the stack. The probe reads through vs1053's buffer.
+ *
+ * \return false once the folder has no more entries.
+ *
+ * \note An error closes the update filehandle.
+ */
+bool vs1053_catalog::scanEntry() {
+  SdFile entry;
+  catalog_record_m record;
+  char name[CATALOG_NAME_LENGTH];
+  uint16_t date = 0;
+  uint16_t time = 0;
+  uint32_t size = 0;
+  bool isHeld;
+  bool isPlayable;
+
+  isHeld = vs1053::holdRefill();
+  if (!entry.openNext(&folder, O_READ)) {
+    vs1053::releaseRefill(isHeld);
+    return false;
+  }
+  {
+    dir_t dirEntry;
+    isPlayable = entry.isFile() && !entry.isHidden() && entry.getName(name, sizeof(name)) && \
+                 strcasecmp_P(name, PSTR(CATALOG_FILE)) && strcasecmp_P(name, PSTR(CATALOG_NEW_FILE)) && \
+                 entry.dirEntry(&dirEntry) && (updateHeader.count < 0xFFFF);
+    if (isPlayable) {
+      date = dirEntry.lastWriteDate;
+      time = dirEntry.lastWriteTime;
+      size = dirEntry.fileSize;
+    }
+  }
+  vs1053::releaseRefill(isHeld);
+
+  if (isPlayable && ((find(name, &record) < 0) || (record.date != date) || \
+                     (record.time != time) || (record.size != size))) {
+    /* New or changed, probe its content */
+    track_meta_m meta;
+    track_tag_m tag;
+    isHeld = vs1053::holdRefill();
+    isPlayable = vs1053::probeTrack(entry, &meta, &tag, vs1053::borrowBuffer(), NULL) != unknownFormat;
+    vs1053::releaseRefill(isHeld);
+    memset(&record, 0, sizeof(record));
+    record.hash = hash(name);
+    record.format = meta.format;
+    record.bitrate = meta.bitrate;
+    record.duration = meta.duration;
+    record.start = meta.start;
+    record.date = date;
+    record.time = time;
+    record.size = size;
+    strncpy(record.title, tag.title, sizeof(record.title) - 1);
+    strncpy(record.artist, tag.artist, sizeof(record.artist) - 1);
+  }
+
+  isHeld = vs1053::holdRefill();
+  if (isPlayable) {
+    record.dirIndex = entry.dirIndex();
+    if (update.seekSet(sizeof(catalog_header_m) + (uint32_t)updateHeader.count * sizeof(catalog_record_m)) && \
+        (update.write(&record, sizeof(record)) == sizeof(record))) {
+      updateHeader.count++;
+    } else {
+      update.close();
+    }
+  }
+  updateHeader.cursor = folder.curPosition();
+  entry.close();
+  vs1053::releaseRefill(isHeld);
+  return update.isOpen();
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Replace the catalog by the refreshed one
+ *
+ * The refreshed catalog is completed and synced before the current one is
+ * removed, so that open() can finish the rename after a power loss.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ */
+uint8_t vs1053_catalog::finishRefresh() {
+  SdFile old;
+  bool isHeld;
+  bool isOk;
+
+  isHeld = vs1053::holdRefill();
+  isOk = update.seekSet(0) && (update.write(&updateHeader, sizeof(updateHeader)) == sizeof(updateHeader));
+  isOk = isOk && update.sync();
+  if (isOk) {
+    if (catalog.isOpen()) catalog.close();
+    if (old.open(&folder, CATALOG_FILE, O_WRITE)) old.remove();
+    isOk = update.rename(&folder, CATALOG_FILE);
+  }
+  update.close();
+  memset(&header, 0, sizeof(header));
+  if (isOk) openIn(folder);
+  vs1053::releaseRefill(isHeld);
+  cancelRefresh();
+  return isOk ? 0 : 4;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Stop the refresh in progress, if any
+ *
+ * The progress saved in CATALOG_NEW_FILE is kept, for refresh() to resume.
+ * The folder is kept open along with the catalog.
+ */
+void vs1053_catalog::cancelRefresh() {
+  bool isHeld = vs1053::holdRefill();
+  if (update.isOpen()) update.close();
+  if (folder.isOpen() && !catalog.isOpen()) folder.close();
+  vs1053::releaseRefill(isHeld);
+  phase = refreshIdle;
+  if (refreshing == this) refreshing = NULL;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read an entry of a hash index
+ *
+ * \param[in] file filehandle of the catalog.
+ * \param[in] offset file offset of the hash index.
+ * \param[in] n entry number.
+ * \param[out] index to be updated with the entry.
+ *
+ * \return true when the entry was read.
+ */
+bool vs1053_catalog::readIndex(SdFile& file, uint32_t offset, uint16_t n, catalog_index_m* index) {
+  return file.seekSet(offset + (uint32_t)n * 6) && \
+         (file.read(&index->hash, 4) == 4) && (file.read(&index->record, 2) == 2);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Write an entry of a hash index
+ *
+ * \param[in] file filehandle of the catalog.
+ * \param[in] offset file offset of the hash index.
+ * \param[in] n entry number.
+ * \param[in] index entry to be written.
+ *
+ * \return true when the entry was written.
+ */
+bool vs1053_catalog::writeIndex(SdFile& file, uint32_t offset, uint16_t n, catalog_index_m* index) {
+  return file.seekSet(offset + (uint32_t)n * 6) && \
+         (file.write(&index->hash, 4) == 4) && (file.write(&index->record, 2) == 2);
+}
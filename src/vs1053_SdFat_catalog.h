@@ -0,0 +1,137 @@
+/**
+\file vs1053_SdFat_catalog.h
+
+\brief Header file for the media catalog of the vs1053 library
+\remarks comments are implemented with Doxygen Markdown format
+
+*/
+
+#ifndef vs1053_catalog_h
+#define vs1053_catalog_h
+
+#include "vs1053_SdFat.h"
+
+/** \brief Version of the catalog file layout, bumped when records change*/
+#define CATALOG_VERSION 2
+
+/** \brief Value of catalog_header_m::cursor once all records are written*/
+#define CATALOG_SCANNED 0xFFFFFFFFUL
+
+/** \brief A record of the media catalog
+ *
+ * Fixed size summary of one playable file of the cataloged folder, as probed
+ * by vs1053_catalog::build(). Records are stored in directory order.
+ */
+struct catalog_record_m {
+/** \brief FNV-1a hash of the lower case file name.*/
+  uint32_t hash;
+/** \brief index of the file's entry in its directory.*/
+  uint16_t dirIndex;
+/** \brief format of the file, as a format_m.*/
+  uint8_t format;
+/** \brief bit-rate in bytes per millisecond, of MP3 files.*/
+  uint8_t bitrate;
+/** \brief playable duration in second, zero when unknown.*/
+  uint16_t duration;
+/** \brief file offset of the first audio frame, or data.*/
+  uint32_t start;
+/** \brief modification date of the file, as in its directory entry.*/
+  uint16_t date;
+/** \brief modification time of the file, as in its directory entry.*/
+  uint16_t time;
+/** \brief size of the file, as in its directory entry.*/
+  uint32_t size;
+  char title[CATALOG_TEXT_LENGTH];
+  char artist[CATALOG_TEXT_LENGTH];
+}; //struct catalog_record_m
+
+/** \brief Header of the media catalog file */
+struct catalog_header_m {
+/** \brief "VSC" followed by the catalog version.*/
+  char magic[4];
+/** \brief number of records.*/
+  uint16_t count;
+/** \brief size of each record, for sanity checking.*/
+  uint16_t recordSize;
+/** \brief file offset of the hash index, sorted by hash, zero until written.*/
+  uint32_t indexOffset;
+/** \brief directory position reached by an unfinished refresh, or CATALOG_SCANNED.*/
+  uint32_t cursor;
+}; //struct catalog_header_m
+
+/** \brief An entry of the catalog's hash index */
+struct catalog_index_m {
+  uint32_t hash;
+  uint16_t record;
+}; //struct catalog_index_m
+
+/** \brief Phase of a catalog refresh */
+enum refresh_m {
+  refreshIdle,
+  refreshScanning,
+  refreshIndexing,
+  refreshSorting,
+}; //enum refresh_m
+
+//------------------------------------------------------------------------------
+/**
+ * \class vs1053_catalog
+ * \brief Media catalog of a folder of the SdCard
+ *
+ * Scans a folder once, probing each file's content, and keeps the result in
+ * the CATALOG_FILE of that folder. Browsing by record number and searching by
+ * file name are then answered from the catalog, without opening the audio
+ * files.
+ *
+ * A refresh only probes the files that are new, or whose modification time or
+ * size changed, into CATALOG_NEW_FILE. It runs in time slices, from
+ * vs1053::available(), and resumes where it stopped after a power loss.
+ *
+ * \note The SdCard is shared with vs1053::refill(), and with the drain of a
+ * recording, so accesses made while a track is playing, or being recorded,
+ * briefly hold them.
+ */
+class vs1053_catalog {
+  public:
+    vs1053_catalog();
+    uint8_t build(const char* folder = "/");
+    uint8_t refresh(const char* folder = "/");
+    uint8_t refreshStep(uint16_t msec = CATALOG_REFRESH_SLICE);
+    bool isRefreshing();
+    uint8_t open(const char* folder = "/");
+    void close();
+    uint16_t count();
+    uint8_t get(uint16_t, catalog_record_m*);
+    int32_t find(const char*, catalog_record_m* record = NULL);
+    static uint32_t hash(const char*);
+    static void available();
+
+  private:
+    bool isNamed(uint16_t, const char*);
+    uint8_t openIn(SdFile&);
+    uint8_t startRefresh(const char*, bool);
+    bool scanEntry();
+    uint8_t finishRefresh();
+    void cancelRefresh();
+    static bool readIndex(SdFile&, uint32_t, uint16_t, catalog_index_m*);
+    static bool writeIndex(SdFile&, uint32_t, uint16_t, catalog_index_m*);
+
+/** \brief filehandle of the open catalog.*/
+    SdFile catalog;
+    catalog_header_m header;
+
+/** \brief filehandle of the cataloged folder, open along with the catalog or a refresh.*/
+    SdFile folder;
+/** \brief filehandle of the catalog being refreshed.*/
+    SdFile update;
+    catalog_header_m updateHeader;
+    refresh_m phase;
+/** \brief progress of the index phases, as the shell sort's gap and entry.*/
+    uint16_t sortGap;
+    uint16_t sortNext;
+
+/** \brief the catalog stepped by available(), if any.*/
+    static vs1053_catalog* refreshing;
+};
+
+#endif // vs1053_catalog_h
@@ -374,9 +374,110 @@ Support for Arduino Leonardo is afflicted by having the SPI pins not routing the
 
 #if defined(OGG_REFILL_USING_TIMER)
   #include <TimerOne.h>
-  #define OGG_REFILL_PERIOD 15000
 #endif
 
+/**
+ * \def OGG_REFILL_PERIOD
+ * \brief The initial period of draining a recording, in microseconds
+ *
+ * Then adapted to the encoder's output rate, within OGG_REFILL_MIN_PERIOD and
+ * OGG_REFILL_MAX_PERIOD, so that about RECORD_TARGET_FILL words are waiting
+ * at each drain. Applies to Timer1, or to the polls of
+ * vs1053::writeOggInLoop() when OGG_REFILL_USING_TIMER is not defined.
+ */
+#define OGG_REFILL_PERIOD 15000
+#define OGG_REFILL_MIN_PERIOD 2000
+#define OGG_REFILL_MAX_PERIOD 100000
+
+/**
+ * \def RECORD_FIFO_WORDS
+ * \brief The size of the VSdsp's recording buffer, in 16-bit words
+ */
+#define RECORD_FIFO_WORDS 1024
+
+/**
+ * \def RECORD_OVERFLOW_WORDS
+ * \brief The words waiting in the recording buffer taken as an overflow
+ *
+ * The datasheet warns that recorded data may be lost beyond 896 words.
+ */
+#define RECORD_OVERFLOW_WORDS 896
+
+/**
+ * \def RECORD_LATENCY_BUCKETS
+ * \brief The number of buckets of the SdCard write latency histogram
+ *
+ * Bucket 0 counts writes under 64 microseconds, each next one writes under
+ * twice as long, the last one all the longer writes. Each takes 4 bytes.
+ */
+#define RECORD_LATENCY_BUCKETS 12
+
+/**
+ * \def RECORD_TARGET_FILL
+ * \brief The number of words aimed to be waiting at each drain of a recording
+ *
+ * Higher wakes up less often, lower leaves more margin for a slow SdCard.
+ */
+#define RECORD_TARGET_FILL 256
+
+/**
+ * \def RECORD_STOP_MARGIN
+ * \brief The room left in a preallocated recording when it is stopped, in bytes
+ *
+ * When vs1053::recordOgg() is given a maximum size, the recording is stopped
+ * once less than this is left, for the data still in the VSdsp's buffer.
+ */
+#define RECORD_STOP_MARGIN 4096
+
+/**
+ * \def RECORD_LEVEL_PERIOD
+ * \brief The number of milliseconds between readings of the recording level
+ *
+ * VOX_LEVEL_PERIOD is used instead when vs1053::setVoiceActivation() is set,
+ * for the level to follow speech.
+ */
+#define RECORD_LEVEL_PERIOD 500
+
+/**
+ * \def VOX_LEVEL_PERIOD
+ * \brief The number of milliseconds between readings of the recording level,
+ * with voice activation
+ *
+ * Used instead of RECORD_LEVEL_PERIOD when vs1053::setVoiceActivation() is
+ * set, so the gate reacts within the attack and hang times.
+ */
+#define VOX_LEVEL_PERIOD 50
+
+/**
+ * \def RECORD_START_BUDGET
+ * \brief The microseconds a recording is expected to start within
+ *
+ * A warning is printed when vs1053::recordOgg() or vs1053::recordWav() take
+ * longer, the time taken being kept in record_stats_m::startLatency.
+ */
+#define RECORD_START_BUDGET 100000
+
+/**
+ * \def RECORD_PATH_LENGTH
+ * \brief The longest path of a recording's file
+ *
+ * Including the terminator, kept for vs1053::setRecordingRotation() to name
+ * the next files. vs1053::recordOgg() and vs1053::recordWav() fail with
+ * longer paths.
+ */
+#define RECORD_PATH_LENGTH 64
+
+/**
+ * \def STREAM_FALLBACK_WRITE
+ * \brief The bytes written to a recording stream reporting no room, per drain
+ *
+ * Streams whose availableForWrite() isn't implemented always report none, so
+ * a drain then writes up to this many bytes to it anyway, waiting for them to
+ * be taken. A full stream may hold up the drain for as long, 0 never does but
+ * leaves such streams unsent.
+ */
+#define STREAM_FALLBACK_WRITE 32
+
 //------------------------------------------------------------------------------
 /**
  * \def BUFFER_SIZE
@@ -386,6 +487,157 @@ Support for Arduino Leonardo is afflicted by having the SPI pins not routing the
 
 #define SKIPPING_SPEED 8
 
+/**
+ * \def POSITION_SAMPLE_PERIOD
+ * \brief The period of sampling the play position, in milliseconds
+ *
+ * refill() reads the decode time and the millisecond position from the VSdsp
+ * at most this often, rather than after every buffer.
+ * vs1053::currentPositionMsec() interpolates in between. While
+ * vs1053::skipTo() fast forwards, they are read after every buffer.
+ */
+#define POSITION_SAMPLE_PERIOD 50
+
+/**
+ * \def SEEK_RAMP_STEPS
+ * \brief The length of the volume ramps around a MP3 seek, in 32-byte chunks
+ *
+ * vs1053::skipTo() fades the volume out over this many chunks fed to the VSdsp,
+ * before jumping the track, and back in after.
+ */
+#define SEEK_RAMP_STEPS 8
+
+/**
+ * \def SEEK_MUTE_CHUNKS
+ * \brief The number of 32-byte chunks fed muted after a MP3 seek
+ *
+ * Covers the frames the VSdsp decodes while resynchronizing, whose bit
+ * reservoir refers to data before the jump. Counted once the 2048 bytes of
+ * the VSdsp's FIFO fed before the jump have been pushed out too.
+ */
+#define SEEK_MUTE_CHUNKS 32
+
+/**
+ * \def SEEK_TABLE_SIZE
+ * \brief The number of seek points kept for MP4/M4A (AAC) tracks
+ *
+ * Each seek point uses 6 bytes of RAM. The chunks of the audio track are
+ * sampled evenly into this many points, so a larger table gives finer skipTo()
+ * resolution on long tracks.
+ */
+#define SEEK_TABLE_SIZE 8
+
+/**
+ * \def TRACK_TAG_LENGTH
+ * \brief The size of the text fields of track_tag_m, including the terminator
+ *
+ * Longer text is cut. A tag takes three times this size of RAM, and two are
+ * kept: the playing track's and, with USE_TRACK_QUEUE, the queued one's.
+ * Lower it on small boards.
+ */
+#define TRACK_TAG_LENGTH 30
+
+/**
+ * \def USE_TRACK_QUEUE
+ * \brief Set to 0 to leave out vs1053::queueNext() and vs1053_playlist
+ *
+ * The queue keeps a second filehandle, track_meta_m and track_tag_m in RAM,
+ * for gapless playback. Without it, each track ends before play() starts the
+ * next.
+ */
+#define USE_TRACK_QUEUE 1
+
+/**
+ * \def MP3_SYNC_SCAN_LIMIT
+ * \brief The number of bytes scanned for the first MP3 frame header
+ *
+ * Counted from the end of any ID3v2 tag. When no frame header is found within
+ * this many bytes the bit-rate is left unknown, rather than reading through
+ * the whole file.
+ */
+#define MP3_SYNC_SCAN_LIMIT 8192
+
+//------------------------------------------------------------------------------
+/**
+ * \def CATALOG_FILE
+ * \brief The name of the media catalog file, kept in each cataloged folder
+ */
+#define CATALOG_FILE "CATALOG.VSC"
+
+/**
+ * \def CATALOG_NEW_FILE
+ * \brief The name of the catalog file being written by a refresh
+ *
+ * Renamed to CATALOG_FILE once complete. Kept across a power loss, for the
+ * refresh to resume.
+ */
+#define CATALOG_NEW_FILE "CATALOG.NEW"
+
+/**
+ * \def CATALOG_REFRESH_SLICE
+ * \brief The time slice of a catalog refresh, in milliseconds
+ *
+ * Time spent refreshing on each call of vs1053::available(). Probing one new
+ * file may take longer.
+ */
+#define CATALOG_REFRESH_SLICE 10
+
+/**
+ * \def CATALOG_TEXT_LENGTH
+ * \brief The size of the title and artist of each catalog record
+ *
+ * Including the terminator. Each record of the catalog file, of
+ * sizeof(catalog_record_m), takes 22 bytes plus twice this size on AVR, 24
+ * with 32-bit alignment.
+ */
+#define CATALOG_TEXT_LENGTH 16
+
+/**
+ * \def CATALOG_NAME_LENGTH
+ * \brief The longest file name hashed when building a catalog
+ *
+ * Including the terminator, allocated on the stack while scanning the folder.
+ * Longer names are skipped.
+ */
+#define CATALOG_NAME_LENGTH 64
+
+//------------------------------------------------------------------------------
+/**
+ * \def PLAYLIST_PATH_LENGTH
+ * \brief The longest line of a playlist, and path of its entries
+ *
+ * Including the terminator, kept in each vs1053_playlist. Entries on longer
+ * lines are skipped.
+ */
+#define PLAYLIST_PATH_LENGTH 64
+
+/**
+ * \def PLAYLIST_CHECKPOINTS
+ * \brief The number of entry offsets kept by each vs1053_playlist
+ *
+ * Reading an entry back scans at most count() / PLAYLIST_CHECKPOINTS * 2
+ * lines. A power of two, each takes 4 bytes.
+ */
+#define PLAYLIST_CHECKPOINTS 32
+
+//------------------------------------------------------------------------------
+/**
+ * \def DECODER_BUFFER_SIZE
+ * \brief The audio data buffer size of each vs1053_decoder
+ *
+ * A multiple of 32, the bytes fed to a VSdsp each time its DREQ is up.
+ */
+#define DECODER_BUFFER_SIZE 64
+
+/**
+ * \def DECODER_SERVICE_ROUNDS
+ * \brief The most rounds of the vs1053_decoder instances per vs1053::available()
+ *
+ * Each round feeds 32 bytes to every decoder asking for it. 64 rounds fill
+ * the VSdsp's 2048 bytes buffer, lower returns to the sketch sooner.
+ */
+#define DECODER_SERVICE_ROUNDS 64
+
 //------------------------------------------------------------------------------
 /**
  * \def PROFILE_LOADER
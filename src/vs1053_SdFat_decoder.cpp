@@ -0,0 +1,404 @@
+/**
+\file vs1053_SdFat_decoder.cpp
+
+\brief Code file for the additional decoders of the vs1053 library
+\remarks comments are implemented with Doxygen Markdown format
+
+*/
+
+#include <vs1053_SdFat_decoder.h>
+//avr pgmspace library for storing the strings in program flash instead of sram
+#include <avr/pgmspace.h>
+
+vs1053_decoder* vs1053_decoder::first;
+vs1053_decoder* vs1053_decoder::served;
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Constructor of the vs1053_decoder class.
+ *
+ * \param[in] xcs control chip select pin of the VS10xx.
+ * \param[in] xdcs data chip select pin of the VS10xx.
+ * \param[in] dreq data request pin of the VS10xx.
+ * \param[in] reset (optional) reset pin of the VS10xx, or DECODER_NO_RESET.
+ */
+vs1053_decoder::vs1053_decoder(uint8_t xcs, uint8_t xdcs, uint8_t dreq, uint8_t reset) :
+  xcs(xcs), xdcs(xdcs), dreq(dreq), reset(reset) {
+  bufferOffset = 0;
+  bufferLength = 0;
+  state = decoderIdle;
+  isPatched = false;
+  volumeLeft = 0x30;
+  volumeRight = 0x30;
+  fed = 0;
+  next = NULL;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Initialize the VS10xx
+ *
+ * Same as vs1053::begin(), with the decoder's pins: resets the VSdsp, by its
+ * reset pin if any, sets its clock and loads "patches.053". Then joins the
+ * decoders serviced by vs1053::available().
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error, as of vs1053::begin()
+ *
+ * \see
+ * \ref Error_Codes
+ *
+ * \note The \c SdFat::begin() function is required to be executed prior.
+ */
+uint8_t vs1053_decoder::begin() {
+  plugin_loader_m loader = {0, 0, 0, xcs, dreq, false};
+  uint8_t result = 0;
+  bool isHeld;
+
+  end();
+  pinMode(dreq, INPUT);
+  pinMode(xcs, OUTPUT);
+  pinMode(xdcs, OUTPUT);
+  digitalWrite(xcs, HIGH);
+  digitalWrite(xdcs, HIGH);
+
+  isHeld = vs1053::holdRefill();
+  if (reset != DECODER_NO_RESET) {
+    pinMode(reset, OUTPUT);
+    digitalWrite(reset, LOW); // Shut down VS1053
+    delay(50);
+    digitalWrite(reset, HIGH); // Bring up VS1053
+  } else {
+    sciWrite(SCI_MODE, SM_LINE1 | SM_SDINEW | SM_RESET); // Soft reset
+  }
+  delay(10);
+
+  if (sciRead(SCI_MODE) != (SM_LINE1 | SM_SDINEW)) {
+    result = 4;
+  } else {
+    /* Speed up */
+    sciWrite(SCI_CLOCKF, 0x6000); // Set multiplier to 3.0x
+    delay(1);
+    if (sciRead(SCI_CLOCKF) != 0x6000) result = 5;
+  }
+
+  if (!result) {
+    state = decoderReady;
+    fed = 0;
+    /* Apply patch */
+    isPatched = !vs1053::loadPluginFile(track, "patches.053", buffer, sizeof(buffer), &loader);
+    if (!isPatched) result = 6;
+    delay(1); // just a good idea to let settle.
+    sciWrite(SCI_VOL, ((uint16_t)volumeLeft << 8) | volumeRight);
+
+    /* Join the service, last */
+    vs1053_decoder** decoder = &first;
+    while (*decoder) decoder = &(*decoder)->next;
+    *decoder = this;
+    next = NULL;
+  }
+  vs1053::releaseRefill(isHeld);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Disable the VS10xx
+ *
+ * Closes the track, if any, leaves the decoders serviced, and places the
+ * VSdsp in hardware reset when it has a reset pin.
+ */
+void vs1053_decoder::end() {
+  bool isHeld;
+
+  if (state == decoderIdle) return;
+  isHeld = vs1053::holdRefill();
+  if (track.isOpen()) track.close();
+  for (vs1053_decoder** decoder = &first; *decoder; decoder = &(*decoder)->next) {
+    if (*decoder == this) {
+      *decoder = next;
+      break;
+    }
+  }
+  if (served == this) served = NULL;
+  if (reset != DECODER_NO_RESET) digitalWrite(reset, LOW); // Put VS1053 into hardware reset
+  state = decoderIdle;
+  vs1053::releaseRefill(isHeld);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Begin playing a track
+ *
+ * \param[in] fileName of the track, opened from the working directory.
+ *
+ * Feeds the VSdsp's buffer once, the rest being fed by vs1053::available().
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error, as of vs1053::play()
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t vs1053_decoder::play(const char* fileName) {
+  bool isHeld;
+
+  if (state == decoderIdle) return 3;
+  if (isBusy()) return 1;
+
+  isHeld = vs1053::holdRefill();
+  if (!isPatched) {
+    plugin_loader_m loader = {0, 0, 0, xcs, dreq, false};
+    isPatched = !vs1053::loadPluginFile(track, "patches.053", buffer, sizeof(buffer), &loader);
+  }
+  if (!track.open(fileName, O_READ)) {
+    vs1053::releaseRefill(isHeld);
+    return 2;
+  }
+  bufferOffset = 0;
+  bufferLength = 0;
+  state = decoderPlaying;
+  while (feed());
+  vs1053::releaseRefill(isHeld);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Stop the playing track
+ *
+ * Closes the track and cancels the decoding, without waiting. The decoder is
+ * busy until vs1053::available() has fed it through the cancel.
+ */
+void vs1053_decoder::stop() {
+  bool isHeld;
+
+  if (state != decoderPlaying) return;
+  isHeld = vs1053::holdRefill();
+  track.close();
+  finish();
+  cancel();
+  vs1053::releaseRefill(isHeld);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Is a track playing, or ending
+ *
+ * \return true until the track has ended, or been stopped, and the VSdsp is
+ * ready for the next one.
+ */
+bool vs1053_decoder::isBusy() {
+  return state >= decoderPlaying;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Set the volume of the VS10xx
+ *
+ * \param[in] leftchannel attenuation in 0.5dB steps, as of vs1053::setVolume().
+ * \param[in] rightchannel attenuation in 0.5dB steps.
+ *
+ * Kept for begin(), when not begun yet.
+ */
+void vs1053_decoder::setVolume(uint8_t leftchannel, uint8_t rightchannel) {
+  bool isHeld;
+
+  volumeLeft = leftchannel;
+  volumeRight = rightchannel;
+  if (state == decoderIdle) return;
+  isHeld = vs1053::holdRefill();
+  sciWrite(SCI_VOL, ((uint16_t)volumeLeft << 8) | volumeRight);
+  vs1053::releaseRefill(isHeld);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Bytes of tracks fed to the VSdsp
+ *
+ * \return the bytes fed since begin(). Sampled over time, and summed over
+ * the decoders, gives the bit-rate sustained by the bus.
+ */
+uint32_t vs1053_decoder::fedBytes() {
+  return fed;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Service the decoders
+ *
+ * Called from vs1053::available(). Feeds the decoders round robin, 32 bytes
+ * to each one whose DREQ is up per round, until a round feeds none or
+ * DECODER_SERVICE_ROUNDS are done. The vs1053's refill is held meanwhile.
+ */
+void vs1053_decoder::available() {
+  vs1053_decoder* start;
+  vs1053_decoder* decoder;
+  bool isFed;
+  bool isHeld;
+
+  for (decoder = first; decoder && !decoder->isBusy(); decoder = decoder->next);
+  if (!decoder) return; // none playing, nor ending
+  if ((vs1053::playing_state == recording) || (vs1053::playing_state == finishing)) return;
+
+  isHeld = vs1053::holdRefill();
+  start = served ? served : first;
+  for (uint8_t round = 0; round < DECODER_SERVICE_ROUNDS; round++) {
+    isFed = false;
+    decoder = start;
+    do {
+      if (decoder->feed()) isFed = true;
+      decoder = decoder->next ? decoder->next : first;
+    } while (decoder != start);
+    if (!isFed) break;
+  }
+  /* Next time, start from the following one */
+  served = start->next ? start->next : first;
+  vs1053::releaseRefill(isHeld);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Feed 32 bytes to the VSdsp, if it asks for them
+ *
+ * Feeds the track, or the end fill bytes once the track has ended.
+ *
+ * \return true when fed, false when not busy or DREQ is down.
+ *
+ * \note The refill is expected to be held by the caller.
+ */
+bool vs1053_decoder::feed() {
+  if ((state < decoderPlaying) || !digitalRead(dreq)) return false;
+
+  if (state != decoderPlaying) {
+    feedFill();
+    return true;
+  }
+
+  /* Read data */
+  if (bufferOffset >= bufferLength) {
+    int16_t n = track.read(buffer, sizeof(buffer));
+    if (n <= 0) {
+      /* track end */
+      track.close();
+      finish();
+      return true;
+    }
+    bufferLength = n;
+    bufferOffset = 0;
+  }
+
+  /* Feed up to 32 bytes */
+  uint8_t n = (bufferLength - bufferOffset < 32) ? bufferLength - bufferOffset : 32;
+  spiSetup(true);
+  digitalWrite(xdcs, LOW);
+  for (uint8_t i = 0; i < n; i++) {
+    SPI.transfer(buffer[bufferOffset + i]);
+  }
+  digitalWrite(xdcs, HIGH);
+  bufferOffset += n;
+  fed += n;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Feed 32 end fill bytes to the VSdsp
+ *
+ * After 2052 of them, as of the datasheet, cancels the decoding. Then checks
+ * for the cancel to be done after each, soft resetting the VSdsp if not done
+ * within 2048 bytes.
+ */
+void vs1053_decoder::feedFill() {
+  spiSetup(true);
+  digitalWrite(xdcs, LOW);
+  for (uint8_t i = 0; i < 32; i++) {
+    SPI.transfer(endFillByte);
+  }
+  digitalWrite(xdcs, HIGH);
+
+  if (state == decoderEnding) {
+    if (!--fillLeft) cancel();
+  } else if (!(sciRead(SCI_MODE) & SM_CANCEL)) {
+    state = decoderReady;
+  } else if (!--fillLeft) {
+    Serial.println(F("Cancelling failed, reset!"));
+    sciWrite(SCI_MODE, sciRead(SCI_MODE) | SM_RESET);
+    delay(1);
+    isPatched = false;
+    state = decoderReady;
+  }
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Begin feeding the end fill bytes
+ *
+ * Reads the end fill byte of the track from the VSdsp, for 2052 of them to
+ * be fed.
+ */
+void vs1053_decoder::finish() {
+  sciWrite(SCI_WRAMADDR, para_endFillByte);
+  endFillByte = (uint8_t)sciRead(SCI_WRAM);
+  fillLeft = (2052 + 31) / 32;
+  state = decoderEnding;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Cancel the decoding
+ *
+ * Sets SM_CANCEL, for at most 2048 end fill bytes to be fed until done.
+ */
+void vs1053_decoder::cancel() {
+  sciWrite(SCI_MODE, sciRead(SCI_MODE) | SM_CANCEL);
+  fillLeft = 2048 / 32;
+  state = decoderCancelling;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Write a register of the VSdsp
+ *
+ * \param[in] address of the VSdsp's register to be written
+ * \param[in] data to be written to the register
+ *
+ * Same as vs1053::sciWrite(), with the decoder's pins and SPI rate.
+ *
+ * \note The refill is expected to be held by the caller.
+ */
+void vs1053_decoder::sciWrite(uint8_t address, uint16_t data) {
+  spiSetup(true);
+  vs1053::sciWrite(xcs, dreq, address, data);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read a register of the VSdsp
+ *
+ * \param[in] address of the VSdsp's register to be read
+ * \return result read from the register
+ *
+ * Same as vs1053::sciRead(), with the decoder's pins and SPI rate.
+ *
+ * \note The refill is expected to be held by the caller.
+ */
+uint16_t vs1053_decoder::sciRead(uint8_t address) {
+  spiSetup(false);
+  return vs1053::sciRead(xcs, dreq, address);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Set up the SPI for the VSdsp
+ *
+ * \param[in] toWrite true for the write rate, false for the read rate.
+ *
+ * The SPI is shared with the SdCard and the other VSdsps, so it is set up
+ * again each time. Until its clock is set by begin(), the VSdsp is run at the
+ * slow reset rate.
+ */
+void vs1053_decoder::spiSetup(bool toWrite) {
+  vs1053::spiInit(toWrite);
+  if (state == decoderIdle) SPI.setClockDivider(SPI_CLOCK_DIV16);
+}
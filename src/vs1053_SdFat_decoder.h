@@ -0,0 +1,99 @@
+/**
+\file vs1053_SdFat_decoder.h
+
+\brief Header file for the additional decoders of the vs1053 library
+\remarks comments are implemented with Doxygen Markdown format
+
+*/
+
+#ifndef vs1053_decoder_h
+#define vs1053_decoder_h
+
+#include "vs1053_SdFat.h"
+
+/** \brief Reset pin of a vs1053_decoder whose VSdsp is soft reset only*/
+#define DECODER_NO_RESET 0xFF
+
+/** \brief State of a vs1053_decoder */
+enum decoder_state_m {
+  decoderIdle,
+  decoderReady,
+  decoderPlaying,
+  decoderEnding,
+  decoderCancelling,
+}; //enum decoder_state_m
+
+//------------------------------------------------------------------------------
+/**
+ * \class vs1053_decoder
+ * \brief An additional VS10xx on the same SPI bus
+ *
+ * Each decoder has its own pins, buffer and filehandle, for tracks to be
+ * played alongside the vs1053 one. All the decoders begun are serviced
+ * together from vs1053::available(), round robin: each one whose DREQ is up
+ * is fed 32 bytes in turn, until none asks for more. The first one served
+ * rotates from a call to the next, so that no decoder is always last.
+ *
+ * A track ends, or is stopped, without waiting. The end fill bytes, then the
+ * cancel, are fed by the same service, the decoder being busy until done.
+ *
+ * Only the decoders are instances. The vs1053 player itself stays static, its
+ * refill being an interrupt handler, so it remains the one VS1053 of the
+ * MP3_XCS, MP3_XDCS and MP3_DREQ pins. All the register accesses go through
+ * vs1053::sciWrite() and vs1053::sciRead(), given the chip's pins.
+ *
+ * \note begin(), play() and the others hold the vs1053's refill, or the drain
+ * of its recording, while using the bus. Decoders are not serviced while it
+ * records though, so as not to hold up its drain for whole rounds.
+ *
+ * \warning Decoders are expected to be global, or end() before destroyed.
+ */
+class vs1053_decoder {
+  public:
+    vs1053_decoder(uint8_t, uint8_t, uint8_t, uint8_t reset = DECODER_NO_RESET);
+    uint8_t begin();
+    void end();
+    uint8_t play(const char*);
+    void stop();
+    bool isBusy();
+    void setVolume(uint8_t, uint8_t);
+    uint32_t fedBytes();
+    static void available();
+
+  private:
+    bool feed();
+    void feedFill();
+    void finish();
+    void cancel();
+    void sciWrite(uint8_t, uint16_t);
+    uint16_t sciRead(uint8_t);
+    void spiSetup(bool);
+
+/** \brief control chip select, data chip select, data request and reset pins.*/
+    uint8_t xcs;
+    uint8_t xdcs;
+    uint8_t dreq;
+    uint8_t reset;
+/** \brief filehandle of the playing track.*/
+    SdFile track;
+    uint8_t buffer[DECODER_BUFFER_SIZE];
+    uint16_t bufferOffset;
+    uint16_t bufferLength;
+    decoder_state_m state;
+    bool isPatched;
+/** \brief end fill byte of the track, and the 32 bytes chunks of it left to feed.*/
+    uint8_t endFillByte;
+    uint8_t fillLeft;
+    uint8_t volumeLeft;
+    uint8_t volumeRight;
+/** \brief bytes of tracks fed to the VSdsp since begin().*/
+    uint32_t fed;
+
+/** \brief the next decoder begun, in service order.*/
+    vs1053_decoder* next;
+/** \brief the decoders begun, and the one served first by the last available().*/
+    static vs1053_decoder* first;
+    static vs1053_decoder* served;
+};
+
+#endif // vs1053_decoder_h
@@ -279,6 +279,47 @@ The following error codes return from the vs1053::skipTo()member function.
 2 Failed to skip to new file location
 </pre>
 
+\subsection recordfunc Recording functions:
+The following error codes return from the vs1053::recordOgg() and vs1053::recordWav() member functions.
+<pre>
+0 OK
+1 Already playing or recording
+2 Profile not loaded, or output file not created
+3 Sample rate not supported
+</pre>
+
+\subsection catalogfunc Catalog functions:
+The following error codes return from the vs1053_catalog::build() and vs1053_catalog::open() member functions.
+<pre>
+0 OK
+2 Folder not found
+3 Catalog file not found, not created or of another version
+4 Failed to write the catalog file
+</pre>
+
+\subsection playlistfunc Playlist functions:
+The following error codes return from the vs1053_playlist::open() member function.
+<pre>
+0 OK
+2 Playlist not found
+3 No entries in the playlist
+</pre>
+The vs1053_playlist::play(), vs1053_playlist::next() and vs1053_playlist::previous() member functions return the codes of vs1053::play(), or the following.
+<pre>
+2 Entry could not be read from the playlist
+3 Beyond the end of the playlist
+</pre>
+
+\subsection decoderfunc Decoder functions:
+The vs1053_decoder::begin() member function returns the codes 4 to 6 of vs1053::begin(), for the decoder's VS10xx.
+The vs1053_decoder::play() member function returns the following.
+<pre>
+0 OK
+1 Already playing track
+2 File not found
+3 Decoder not begun
+</pre>
+
 \section comment Support
 The code has been written with plenty of appropiate comments, describing key components, features and reasonings in Doxygen markdown style as to autogenerate this html suppoting document. Which is loaded into the repositories' gh-page branch to be displayed on the projects's GitHub Page.
 
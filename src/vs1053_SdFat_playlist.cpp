@@ -0,0 +1,368 @@
+/**
+\file vs1053_SdFat_playlist.cpp
+
+\brief Code file for the playlists of the vs1053 library
+\remarks comments are implemented with Doxygen Markdown format
+
+*/
+
+#include <vs1053_SdFat_playlist.h>
+//avr pgmspace library for storing the strings in program flash instead of sram
+#include <avr/pgmspace.h>
+
+#if USE_TRACK_QUEUE
+
+vs1053_playlist* vs1053_playlist::playing;
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Greatest common divisor, for the shuffle multiplier.
+ */
+static uint16_t gcd(uint16_t a, uint16_t b) {
+  while (b) {
+    uint16_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Constructor of the vs1053_playlist class.
+ *
+ * \param[in] player the vs1053 instance to play the entries with.
+ */
+vs1053_playlist::vs1053_playlist(vs1053& player) : player(player) {
+  entries = 0;
+  stride = 1;
+  shuffleStep = 1;
+  shuffleOffset = 0;
+  position = 0;
+  played = 0;
+  isQueued = false;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Open a playlist
+ *
+ * \param[in] fileName path of the playlist. A ".pls" extension selects the PLS
+ * format, otherwise the file is read as M3U, or M3U8.
+ *
+ * Reads the playlist once, counting its entries. Comments, blank lines and
+ * URLs are skipped, as are paths longer than PLAYLIST_PATH_LENGTH.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t vs1053_playlist::open(const char* fileName) {
+  uint8_t len = strlen(fileName);
+  uint32_t offset;
+  bool isHeld;
+  bool isRead;
+
+  close();
+  isPls = (len >= 4) && !strcasecmp_P(&fileName[len - 4], PSTR(".pls"));
+  isHeld = vs1053::holdRefill();
+  isRead = list.open(fileName, O_READ);
+  vs1053::releaseRefill(isHeld);
+  if (!isRead) return 2;
+  while (entries < 0xFFFF) {
+    /* Hold the refill by entry, for the track to carry on meanwhile */
+    isHeld = vs1053::holdRefill();
+    isRead = nextEntry(&offset);
+    vs1053::releaseRefill(isHeld);
+    if (!isRead) break;
+    if (!(entries % stride)) {
+      if (entries / stride == PLAYLIST_CHECKPOINTS) {
+        /* Full, keep every other checkpoint */
+        for (uint8_t i = 0; i < PLAYLIST_CHECKPOINTS / 2; i++) {
+          checkpoint[i] = checkpoint[2 * i];
+        }
+        stride *= 2;
+      }
+      if (!(entries % stride)) checkpoint[entries / stride] = offset;
+    }
+    entries++;
+  }
+  if (!entries) {
+    close();
+    return 3;
+  }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Close the playlist
+ *
+ * The track playing carries on, but the following entries are no longer
+ * queued.
+ */
+void vs1053_playlist::close() {
+  bool isHeld;
+
+  if (playing == this) playing = NULL;
+  isHeld = vs1053::holdRefill();
+  if (list.isOpen()) list.close();
+  vs1053::releaseRefill(isHeld);
+  entries = 0;
+  stride = 1;
+  shuffleStep = 1;
+  shuffleOffset = 0;
+  position = 0;
+  isQueued = false;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Number of entries of the playlist
+ *
+ * \return the number of entries, zero when not open.
+ */
+uint16_t vs1053_playlist::count() {
+  return entries;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Shuffle the play order
+ *
+ * \param[in] isShuffled true for a new random order, false for the order of
+ * the playlist.
+ *
+ * The play order maps position i to entry (step * i + offset) mod count(),
+ * with a random step coprime with count(), which is a permutation.
+ *
+ * \note Seed Arduino's \c random() prior, for a different order on each
+ * start. Takes effect on the next play().
+ */
+void vs1053_playlist::shuffle(bool isShuffled) {
+  shuffleStep = 1;
+  shuffleOffset = 0;
+  if (!isShuffled || (entries < 2)) return;
+  do {
+    shuffleStep = random(1, entries);
+  } while (gcd(shuffleStep, entries) != 1);
+  shuffleOffset = random(entries);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Play the playlist from a position
+ *
+ * \param[in] n position in play order to start from.
+ *
+ * Stops the track playing, if any, plays the entry and queues the following
+ * one.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t vs1053_playlist::play(uint16_t n) {
+  uint8_t result;
+
+  if (n >= entries) return 3;
+  playing = NULL; // not followed while switching
+  isQueued = false;
+  if (player.isBusy() == 0x01) {
+    player.stop();
+    while (player.isBusy() == 0x03) vs1053::available();
+  }
+  position = n;
+  result = readEntry(order(n)) ? player.play(path) : 2;
+  if (result) return result;
+  played = vs1053::playCount;
+  playing = this;
+  queue();
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Play the following entry of the playlist
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t vs1053_playlist::next() {
+  return play(position + 1);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Play the preceding entry of the playlist
+ *
+ * Restarts the first entry when at the start of the playlist.
+ *
+ * \return Any Value other than zero indicates a problem occured.
+ * where value indicates specific error
+ *
+ * \see
+ * \ref Error_Codes
+ */
+uint8_t vs1053_playlist::previous() {
+  return play(position ? position - 1 : 0);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Position of the current track
+ *
+ * \return the position of the current track, in play order.
+ */
+uint16_t vs1053_playlist::current() {
+  return position;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Follow the player onto the queued entry, if any
+ *
+ * Called by vs1053::available().
+ */
+void vs1053_playlist::available() {
+  if (playing) playing->follow();
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read the next entry of the playlist
+ *
+ * \param[out] offset updated with the file offset of the entry's line.
+ *
+ * Reads lines into path until one is an entry, leaving its path alone in the
+ * buffer.
+ *
+ * \return false at the end of the playlist.
+ *
+ * \note The refill is expected to be held by the caller.
+ */
+bool vs1053_playlist::nextEntry(uint32_t* offset) {
+  int16_t len;
+  int16_t c;
+  char* entry;
+
+  while (true) {
+    *offset = list.curPosition();
+    len = list.fgets(path, sizeof(path));
+    if (len <= 0) return false;
+    if ((len == sizeof(path) - 1) && (path[len - 1] != '\n')) {
+      c = list.read();
+      if (c == '\r') c = list.read(); // the CR of a CRLF, not part of the path
+      if ((c >= 0) && (c != '\n')) {
+        /* Too long for the buffer, skip the rest of the line */
+        while (((c = list.read()) >= 0) && (c != '\n'));
+        continue;
+      }
+    }
+    while (len && ((path[len - 1] == '\n') || (path[len - 1] == '\r') || \
+                   (path[len - 1] == ' ') || (path[len - 1] == '\t'))) {
+      path[--len] = '\0';
+    }
+
+    entry = path;
+    if (!*offset && !memcmp_P(entry, PSTR("\xEF\xBB\xBF"), 3)) entry += 3; // UTF-8 BOM
+    if (isPls) {
+      /* FileN=path */
+      if (strncasecmp_P(entry, PSTR("File"), 4)) continue;
+      for (entry += 4; isdigit(*entry); entry++);
+      if (*entry++ != '=') continue;
+    } else if (*entry == '#') {
+      continue; // M3U directives and comments
+    }
+    if (!*entry || strstr_P(entry, PSTR("://"))) continue; // blank, or not on the SdCard
+
+    for (char* p = entry; *p; p++) {
+      if (*p == '\\') *p = '/';
+    }
+    memmove(path, entry, strlen(entry) + 1);
+    return true;
+  }
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Read an entry of the playlist into path
+ *
+ * \param[in] n entry number, in file order.
+ *
+ * Scans from the nearest checkpoint before the entry, holding the refill
+ * one entry at a time.
+ *
+ * \return true when the entry was read.
+ */
+bool vs1053_playlist::readEntry(uint16_t n) {
+  uint16_t i = n - n % stride;
+  uint32_t offset;
+  bool isFound = false;
+  bool isRead;
+  bool isHeld;
+
+  if (n >= entries) return false;
+  isHeld = vs1053::holdRefill();
+  isRead = list.seekSet(checkpoint[n / stride]);
+  vs1053::releaseRefill(isHeld);
+  while (isRead && !isFound) {
+    /* Hold the refill by entry, for the track to carry on meanwhile */
+    isHeld = vs1053::holdRefill();
+    isRead = nextEntry(&offset);
+    vs1053::releaseRefill(isHeld);
+    isFound = isRead && (i++ == n);
+  }
+  return isFound;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Map a position of the play order to an entry
+ *
+ * \param[in] n position in play order.
+ *
+ * \return the entry number, in file order.
+ */
+uint16_t vs1053_playlist::order(uint16_t n) {
+  return ((uint32_t)shuffleStep * n + shuffleOffset) % entries;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Queue the entry following the current track, if any
+ */
+void vs1053_playlist::queue() {
+  isQueued = (position + 1 < entries) && readEntry(order(position + 1)) && !player.queueNext(path);
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Track the player's move onto the queued entry
+ *
+ * Once the player started the queued entry, it becomes the current one and
+ * the following entry is queued. When the player was stopped instead, or
+ * played another track, the playlist stops being followed.
+ */
+void vs1053_playlist::follow() {
+  if (vs1053::playCount == played) {
+    if (vs1053::nextTrack.isOpen()) return; // still on the current track
+    if (isQueued && (player.isBusy() == 0x01)) {
+      position++;
+      queue();
+      return;
+    }
+    if (player.isBusy()) return;
+  }
+  isQueued = false;
+  playing = NULL;
+}
+
+#endif // USE_TRACK_QUEUE
@@ -0,0 +1,82 @@
+/**
+\file vs1053_SdFat_playlist.h
+
+\brief Header file for the playlists of the vs1053 library
+\remarks comments are implemented with Doxygen Markdown format
+
+*/
+
+#ifndef vs1053_playlist_h
+#define vs1053_playlist_h
+
+#include "vs1053_SdFat.h"
+
+#if USE_TRACK_QUEUE
+
+//------------------------------------------------------------------------------
+/**
+ * \class vs1053_playlist
+ * \brief Playback of a M3U or PLS playlist of the SdCard
+ *
+ * The playlist file is read line by line, never loaded as a whole. Opening it
+ * counts its entries and keeps the file offsets of up to PLAYLIST_CHECKPOINTS
+ * of them, evenly spread, so that any entry is read back by scanning only a
+ * fraction of the file.
+ *
+ * While a track plays, the following entry is already opened and probed with
+ * vs1053::queueNext(). vs1053::available() then queues the next one each time
+ * the player moves on.
+ *
+ * Shuffling maps the play order through an affine permutation of the entries,
+ * so it takes no memory per entry.
+ *
+ * \note Relative entries are opened from the working directory, as by
+ * vs1053::play(). So \c sd.chdir() to the playlist's folder first.
+ */
+class vs1053_playlist {
+  public:
+    vs1053_playlist(vs1053&);
+    uint8_t open(const char*);
+    void close();
+    uint16_t count();
+    void shuffle(bool isShuffled = true);
+    uint8_t play(uint16_t n = 0);
+    uint8_t next();
+    uint8_t previous();
+    uint16_t current();
+    static void available();
+
+  private:
+    bool nextEntry(uint32_t*);
+    bool readEntry(uint16_t);
+    uint16_t order(uint16_t);
+    void queue();
+    void follow();
+
+    vs1053& player;
+/** \brief filehandle of the open playlist.*/
+    SdFile list;
+    bool isPls;
+    uint16_t entries;
+/** \brief number of entries between two checkpoints.*/
+    uint16_t stride;
+/** \brief file offsets of the entries 0, stride, 2 * stride, ...*/
+    uint32_t checkpoint[PLAYLIST_CHECKPOINTS];
+/** \brief multiplier and offset of the shuffled play order, 1 and 0 in order.*/
+    uint16_t shuffleStep;
+    uint16_t shuffleOffset;
+/** \brief position of the current track, in play order.*/
+    uint16_t position;
+/** \brief vs1053::playCount of the playlist's own play().*/
+    uint16_t played;
+    bool isQueued;
+/** \brief path of the entry last read.*/
+    char path[PLAYLIST_PATH_LENGTH];
+
+/** \brief the playlist followed by available(), if any.*/
+    static vs1053_playlist* playing;
+};
+
+#endif // USE_TRACK_QUEUE
+
+#endif // vs1053_playlist_h